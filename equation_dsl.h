@@ -0,0 +1,477 @@
+#ifndef FAS_EQUATION_DSL_H
+#define FAS_EQUATION_DSL_H
+
+#include "../../cosmo_macros.h"
+#include "equation_kernel.h"
+
+/**
+ * Compile-time description of elliptic equations.
+ *
+ * An equation F(u) = 0 is written as an expression, eg.
+ *
+ *   using namespace cosmo::fas_dsl;
+ *   auto hamiltonian = kernel(Lap<U0>() + C * Rho<0>() * Pow<U0,5>());
+ *   multigrid.setEquationKernel(0, &hamiltonian);
+ *
+ * where Rho<m> is the source grid of molecule m of the equation (set with
+ * FASMultigrid::setPolySrcAtPt()). The resulting kernel has all stencils,
+ * exponents and variable ids resolved at compile time.
+ */
+
+namespace cosmo
+{
+namespace fas_dsl
+{
+
+/**
+ * @brief a grid point seen by an expression
+ */
+struct pt
+{
+  const fas_kernel_ctx & c;
+  idx_t i, j, k, idx;
+
+  pt(const fas_kernel_ctx & c_in, idx_t i_in, idx_t j_in, idx_t k_in)
+    : c(c_in), i(i_in), j(j_in), k(k_in), idx(c_in.xo[i_in] + c_in.yo[j_in] + c_in.zo[k_in]) {}
+
+  inline real_t at(const real_t * grid, idx_t di, idx_t dj, idx_t dk) const
+  {
+    return grid[c.xo[i + di] + c.yo[j + dj] + c.zo[k + dk]];
+  }
+};
+
+/**
+ * @brief base of all expressions
+ * @details every expression E provides
+ *   static constexpr idx_t max_var: largest variable id used, -1 if none
+ *   static constexpr bool uses(idx_t u_id): whether E depends on u_id
+ *   real_t value(const pt & p): value of E
+ *   template<idx_t U> real_t lin(const pt & p, real_t & diag, real_t & off):
+ *     value of E; diag / off are set to the diagonal of dE/du_U and the
+ *     off-diagonal part of dE/du_U applied to v
+ */
+template<class D>
+struct expr
+{
+  const D & self() const { return static_cast<const D &>(*this); }
+};
+
+/**
+ * @brief tag for variable u_N
+ */
+template<idx_t N>
+struct Var
+{
+  static constexpr idx_t id = N;
+};
+typedef Var<0> U0;
+typedef Var<1> U1;
+typedef Var<2> U2;
+typedef Var<3> U3;
+
+constexpr idx_t max_id(idx_t a, idx_t b) { return a > b ? a : b; }
+
+/**
+ * @brief x^P for integer P as a multiplication chain
+ */
+template<int P, bool negative = (P < 0)>
+struct ipow
+{
+  static inline real_t eval(real_t x) { return 1.0 / ipow<-P>::eval(x); }
+};
+template<int P>
+struct ipow<P, false>
+{
+  static inline real_t eval(real_t x)
+  {
+    return (P % 2) ? x * ipow<P - 1>::eval(x) : ipow<P / 2>::eval(x * x);
+  }
+};
+template<>
+struct ipow<0, false>
+{
+  static inline real_t eval(real_t) { return 1.0; }
+};
+template<>
+struct ipow<1, false>
+{
+  static inline real_t eval(real_t x) { return x; }
+};
+
+/**
+ * @brief runtime constant
+ */
+struct Const : expr<Const>
+{
+  static constexpr idx_t max_var = -1;
+  static constexpr bool uses(idx_t) { return false; }
+
+  real_t c;
+  Const(real_t c_in) : c(c_in) {}
+
+  inline real_t value(const pt &) const { return c; }
+
+  template<idx_t U>
+  inline real_t lin(const pt &, real_t & diag, real_t & off) const
+  {
+    diag = off = 0.0;
+    return c;
+  }
+};
+
+/**
+ * @brief source grid of molecule M
+ */
+template<idx_t M>
+struct Rho : expr< Rho<M> >
+{
+  static constexpr idx_t max_var = -1;
+  static constexpr bool uses(idx_t) { return false; }
+
+  inline real_t value(const pt & p) const { return p.c.rho[M][p.idx]; }
+
+  template<idx_t U>
+  inline real_t lin(const pt & p, real_t & diag, real_t & off) const
+  {
+    diag = off = 0.0;
+    return value(p);
+  }
+};
+
+/**
+ * @brief integer power of a variable
+ */
+template<class V, int P>
+struct Pow : expr< Pow<V, P> >
+{
+  static constexpr idx_t max_var = V::id;
+  static constexpr bool uses(idx_t u_id) { return u_id == V::id; }
+
+  inline real_t value(const pt & p) const
+  {
+    return ipow<P>::eval(p.c.u[V::id][p.idx]);
+  }
+
+  template<idx_t U>
+  inline real_t lin(const pt & p, real_t & diag, real_t & off) const
+  {
+    real_t x = p.c.u[V::id][p.idx];
+    diag = (U == V::id) ? P * ipow<P - 1>::eval(x) : 0.0;
+    off = 0.0;
+    return ipow<P>::eval(x);
+  }
+};
+
+template<class V>
+using Val = Pow<V, 1>;
+
+/**
+ * stencil policies: apply(grid, p) applies the stencil, center(p)
+ * returns the weight of the (0,0,0) tap
+ */
+template<int D>
+struct der1_op
+{
+  static inline real_t apply(const real_t * g, const pt & p)
+  {
+    const int R = STENCIL_ORDER / 2;
+    real_t r = 0.0;
+    for(int o = 1; o <= R; o++)
+      r += fas_der1_coef[R][o] * (p.at(g, (D==1)*o, (D==2)*o, (D==3)*o)
+        - p.at(g, -(D==1)*o, -(D==2)*o, -(D==3)*o));
+    return r * p.c.inv_h[D-1];
+  }
+  static inline real_t center(const pt &) { return 0.0; }
+};
+
+template<int D>
+struct der2_op
+{
+  static inline real_t apply(const real_t * g, const pt & p)
+  {
+    const int R = STENCIL_ORDER / 2;
+    real_t r = fas_der2_coef[R][0] * g[p.idx];
+    for(int o = 1; o <= R; o++)
+      r += fas_der2_coef[R][o] * (p.at(g, (D==1)*o, (D==2)*o, (D==3)*o)
+        + p.at(g, -(D==1)*o, -(D==2)*o, -(D==3)*o));
+    return r * p.c.inv_h[D-1] * p.c.inv_h[D-1];
+  }
+  static inline real_t center(const pt & p)
+  {
+    return fas_der2_coef[STENCIL_ORDER / 2][0] * p.c.inv_h[D-1] * p.c.inv_h[D-1];
+  }
+};
+
+template<int D1, int D2>
+struct mixed_op
+{
+  static inline real_t apply(const real_t * g, const pt & p)
+  {
+    const int R = STENCIL_ORDER / 2;
+    real_t r = 0.0;
+    for(int o1 = 1; o1 <= R; o1++)
+      for(int o2 = 1; o2 <= R; o2++)
+      {
+        idx_t pp[2] = {o1, o2}, pm[2] = {o1, -o2}, mp[2] = {-o1, o2}, mm[2] = {-o1, -o2};
+        r += fas_der1_coef[R][o1] * fas_der1_coef[R][o2] * (
+            p.at(g, (D1==1)*pp[0] + (D2==1)*pp[1], (D1==2)*pp[0] + (D2==2)*pp[1], (D1==3)*pp[0] + (D2==3)*pp[1])
+          - p.at(g, (D1==1)*pm[0] + (D2==1)*pm[1], (D1==2)*pm[0] + (D2==2)*pm[1], (D1==3)*pm[0] + (D2==3)*pm[1])
+          - p.at(g, (D1==1)*mp[0] + (D2==1)*mp[1], (D1==2)*mp[0] + (D2==2)*mp[1], (D1==3)*mp[0] + (D2==3)*mp[1])
+          + p.at(g, (D1==1)*mm[0] + (D2==1)*mm[1], (D1==2)*mm[0] + (D2==2)*mm[1], (D1==3)*mm[0] + (D2==3)*mm[1]));
+      }
+    return r * p.c.inv_h[D1-1] * p.c.inv_h[D2-1];
+  }
+  static inline real_t center(const pt &) { return 0.0; }
+};
+
+struct lap_op
+{
+  static inline real_t apply(const real_t * g, const pt & p)
+  {
+    return der2_op<1>::apply(g, p) + der2_op<2>::apply(g, p) + der2_op<3>::apply(g, p);
+  }
+  static inline real_t center(const pt & p)
+  {
+    return der2_op<1>::center(p) + der2_op<2>::center(p) + der2_op<3>::center(p);
+  }
+};
+
+/**
+ * @brief linear stencil applied to a variable
+ */
+template<class V, class Op>
+struct Stencil : expr< Stencil<V, Op> >
+{
+  static constexpr idx_t max_var = V::id;
+  static constexpr bool uses(idx_t u_id) { return u_id == V::id; }
+
+  inline real_t value(const pt & p) const
+  {
+    return Op::apply(p.c.u[V::id], p);
+  }
+
+  template<idx_t U>
+  inline real_t lin(const pt & p, real_t & diag, real_t & off) const
+  {
+    if(U == V::id)
+    {
+      diag = Op::center(p);
+      off = Op::apply(p.c.v[V::id], p) - diag * p.c.v[V::id][p.idx];
+    }
+    else
+      diag = off = 0.0;
+    return value(p);
+  }
+};
+
+template<class V, int D> using Der = Stencil< V, der1_op<D> >;
+template<class V, int D> using DDer = Stencil< V, der2_op<D> >;
+template<class V, int D1, int D2> using Mixed = Stencil< V, mixed_op<D1, D2> >;
+template<class V> using Lap = Stencil< V, lap_op >;
+
+/**
+ * @brief sum of two expressions
+ */
+template<class A, class B>
+struct Sum : expr< Sum<A, B> >
+{
+  static constexpr idx_t max_var = max_id(A::max_var, B::max_var);
+  static constexpr bool uses(idx_t u_id) { return A::uses(u_id) || B::uses(u_id); }
+
+  A a;
+  B b;
+  Sum(const A & a_in, const B & b_in) : a(a_in), b(b_in) {}
+
+  inline real_t value(const pt & p) const { return a.value(p) + b.value(p); }
+
+  template<idx_t U>
+  inline real_t lin(const pt & p, real_t & diag, real_t & off) const
+  {
+    if(!uses(U))
+    {
+      diag = off = 0.0;
+      return value(p);
+    }
+    real_t da, oa, db, ob;
+    real_t va = a.template lin<U>(p, da, oa);
+    real_t vb = b.template lin<U>(p, db, ob);
+    diag = da + db;
+    off = oa + ob;
+    return va + vb;
+  }
+};
+
+/**
+ * @brief product of two expressions
+ */
+template<class A, class B>
+struct Prod : expr< Prod<A, B> >
+{
+  static constexpr idx_t max_var = max_id(A::max_var, B::max_var);
+  static constexpr bool uses(idx_t u_id) { return A::uses(u_id) || B::uses(u_id); }
+
+  A a;
+  B b;
+  Prod(const A & a_in, const B & b_in) : a(a_in), b(b_in) {}
+
+  inline real_t value(const pt & p) const { return a.value(p) * b.value(p); }
+
+  template<idx_t U>
+  inline real_t lin(const pt & p, real_t & diag, real_t & off) const
+  {
+    if(!A::uses(U) && !B::uses(U))
+    {
+      diag = off = 0.0;
+      return value(p);
+    }
+    if(!B::uses(U))
+    {
+      real_t vb = b.value(p);
+      real_t va = a.template lin<U>(p, diag, off);
+      diag *= vb;
+      off *= vb;
+      return va * vb;
+    }
+    if(!A::uses(U))
+    {
+      real_t va = a.value(p);
+      real_t vb = b.template lin<U>(p, diag, off);
+      diag *= va;
+      off *= va;
+      return va * vb;
+    }
+    real_t da, oa, db, ob;
+    real_t va = a.template lin<U>(p, da, oa);
+    real_t vb = b.template lin<U>(p, db, ob);
+    diag = da * vb + va * db;
+    off = oa * vb + va * ob;
+    return va * vb;
+  }
+};
+
+template<class A, class B>
+inline Sum<A, B> operator+(const expr<A> & a, const expr<B> & b)
+{
+  return Sum<A, B>(a.self(), b.self());
+}
+
+template<class A, class B>
+inline Prod<A, B> operator*(const expr<A> & a, const expr<B> & b)
+{
+  return Prod<A, B>(a.self(), b.self());
+}
+
+template<class B>
+inline Prod<Const, B> operator*(real_t c, const expr<B> & b)
+{
+  return Prod<Const, B>(Const(c), b.self());
+}
+
+template<class A>
+inline Prod<Const, A> operator*(const expr<A> & a, real_t c)
+{
+  return Prod<Const, A>(Const(c), a.self());
+}
+
+template<class A>
+inline Prod<Const, A> operator-(const expr<A> & a)
+{
+  return Prod<Const, A>(Const(-1.0), a.self());
+}
+
+template<class A, class B>
+inline Sum< A, Prod<Const, B> > operator-(const expr<A> & a, const expr<B> & b)
+{
+  return Sum< A, Prod<Const, B> >(a.self(), Prod<Const, B>(Const(-1.0), b.self()));
+}
+
+/**
+ * @brief unrolled dispatch of runtime variable id to lin<U>()
+ */
+template<class E, idx_t U, bool done = (U > E::max_var)>
+struct lin_dispatch
+{
+  static inline void jac(const E & e, const pt & p, idx_t u_id,
+    real_t & coef_a, real_t & coef_b)
+  {
+    if(u_id == U)
+    {
+      real_t diag, off;
+      e.template lin<U>(p, diag, off);
+      coef_a += off;
+      coef_b += diag;
+    }
+    else
+      lin_dispatch<E, U + 1>::jac(e, p, u_id, coef_a, coef_b);
+  }
+
+  static inline real_t der(const E & e, const pt & p, idx_t u_id)
+  {
+    if(u_id == U)
+    {
+      real_t diag, off;
+      e.template lin<U>(p, diag, off);
+      return diag * p.c.v[U][p.idx] + off;
+    }
+    return lin_dispatch<E, U + 1>::der(e, p, u_id);
+  }
+};
+
+template<class E, idx_t U>
+struct lin_dispatch<E, U, true>
+{
+  static inline void jac(const E &, const pt &, idx_t, real_t &, real_t &) {}
+  static inline real_t der(const E &, const pt &, idx_t) { return 0.0; }
+};
+
+/**
+ * @brief equation kernel built from an expression
+ */
+template<class E>
+class Kernel : public FASEquationKernel
+{
+ public:
+  E e;
+
+  Kernel(const E & e_in) : e(e_in) {}
+
+  real_t residual(const fas_kernel_ctx & ctx, idx_t i, idx_t j, idx_t k)
+  {
+    return e.value(pt(ctx, i, j, k));
+  }
+
+  void iterationForJac(const fas_kernel_ctx & ctx, idx_t i, idx_t j, idx_t k,
+    idx_t u_id, real_t & coef_a, real_t & coef_b)
+  {
+    lin_dispatch<E, 0>::jac(e, pt(ctx, i, j, k), u_id, coef_a, coef_b);
+  }
+
+  real_t derivative(const fas_kernel_ctx & ctx, idx_t i, idx_t j, idx_t k,
+    idx_t u_id)
+  {
+    return lin_dispatch<E, 0>::der(e, pt(ctx, i, j, k), u_id);
+  }
+
+  void evaluate(const fas_kernel_ctx & ctx, const fas_tiling & tiling,
+    real_t * result)
+  {
+    idx_t i, j, k;
+    #pragma omp parallel for default(shared) private(i,j,k)
+    FAS_TILED_LOOP3(i, j, k, tiling)
+      result[(i*tiling.ny + j)*tiling.nz + k] = e.value(pt(ctx, i, j, k));
+  }
+};
+
+/**
+ * @brief build an equation kernel from an expression
+ */
+template<class E>
+inline Kernel<E> kernel(const expr<E> & e)
+{
+  return Kernel<E>(e.self());
+}
+
+} // namespace fas_dsl
+} // namespace cosmo
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef FAS_EQUATION_KERNEL_H
+#define FAS_EQUATION_KERNEL_H
+
+#include "../../cosmo_types.h"
+#include "grid_tiling.h"
+
+/**
+ * fields of fas_kernel_ctx; kept in a macro so that exactly the same
+ * layout can be emitted into generated kernel source
+ */
+#define FAS_KERNEL_CTX_FIELDS                                          \
+  real_t * const * u;                                                  \
+  real_t * const * v;                                                  \
+  real_t * const * rho;                                                \
+  const idx_t * xo;                                                    \
+  const idx_t * yo;                                                    \
+  const idx_t * zo;                                                    \
+  real_t inv_h[3];
+
+#define FAS_STRINGIFY(x) #x
+#define FAS_XSTRINGIFY(x) FAS_STRINGIFY(x)
+
+namespace cosmo
+{
+
+/**
+ * central finite difference weights for first and second derivatives,
+ * indexed by [STENCIL_ORDER/2][offset]; second derivative weights are
+ * symmetric, first derivative weights antisymmetric in the offset
+ */
+static const real_t fas_der1_coef[5][5] = {
+  {0.0},
+  {0.0, 1.0/2.0},
+  {0.0, 2.0/3.0, -1.0/12.0},
+  {0.0, 3.0/4.0, -3.0/20.0, 1.0/60.0},
+  {0.0, 4.0/5.0, -1.0/5.0, 4.0/105.0, -1.0/280.0}
+};
+static const real_t fas_der2_coef[5][5] = {
+  {0.0},
+  {-2.0, 1.0},
+  {-5.0/2.0, 4.0/3.0, -1.0/12.0},
+  {-49.0/18.0, 3.0/2.0, -3.0/20.0, 1.0/90.0},
+  {-205.0/72.0, 8.0/5.0, -1.0/5.0, 8.0/315.0, -1.0/560.0}
+};
+
+/**
+ * @brief grid access context handed to equation kernels
+ * @details one per equation and depth;
+ *  u / v: base pointers of u_h / damping_v_h for every variable,
+ *  rho: base pointers of source grids for every molecule of the equation (NULL if none),
+ *  xo / yo / zo: per-axis offsets, periodically wrapped or into padded grids;
+ *  index of (i,j,k) is xo[i] + yo[j] + zo[k]
+ *  for neighbours up to STENCIL_ORDER/2 away,
+ *  inv_h: inverse grid spacing in x, y and z direction
+ */
+typedef struct{
+  FAS_KERNEL_CTX_FIELDS
+} fas_kernel_ctx;
+
+/**
+ * @brief specialized point-wise evaluation of one equation
+ * @details replaces the interpreted equation tape for a single equation;
+ *  semantics match FASMultigrid::_evaluateEllipticEquationPt(),
+ *  _evaluateIterationForJacEquation() and _evaluateDerEllipticEquation()
+ */
+class FASEquationKernel
+{
+ public:
+  virtual ~FASEquationKernel() {}
+
+  /**
+   * @brief value of F(u) at a point
+   */
+  virtual real_t residual(const fas_kernel_ctx & ctx, idx_t i, idx_t j,
+    idx_t k) = 0;
+
+  /**
+   * @brief add off-diagonal part of dF/du_{u_id} * v to coef_a and
+   *  diagonal of dF/du_{u_id} to coef_b
+   */
+  virtual void iterationForJac(const fas_kernel_ctx & ctx, idx_t i, idx_t j,
+    idx_t k, idx_t u_id, real_t & coef_a, real_t & coef_b) = 0;
+
+  /**
+   * @brief value of dF/du_{u_id} * v at a point
+   */
+  virtual real_t derivative(const fas_kernel_ctx & ctx, idx_t i, idx_t j,
+    idx_t k, idx_t u_id) = 0;
+
+  /**
+   * @brief evaluate F(u) on a whole grid, tile by tile
+   * @details result is stored in the (unpadded) layout of arr_t;
+   *  kernels able to inline residual() should override this
+   */
+  virtual void evaluate(const fas_kernel_ctx & ctx, const fas_tiling & tiling,
+    real_t * result)
+  {
+    idx_t i, j, k;
+    #pragma omp parallel for default(shared) private(i,j,k)
+    FAS_TILED_LOOP3(i, j, k, tiling)
+      result[(i*tiling.ny + j)*tiling.nz + k] = residual(ctx, i, j, k);
+  }
+};
+
+} // namespace cosmo
+
+#endif
@@ -1,9 +1,94 @@
 #include "full_multigrid.h"
+#include "kernel_jit.h"
 #include "../../utils/math.h"
 
+#include <sstream>
+
 namespace cosmo
 {
 
+/**
+ * @brief x^value assembled from precomputed squares
+ *
+ * @param pow_class exponent class (see FASMultigrid::pow_class_t)
+ * @param pow_n integer exponent, or twice a half-integer exponent
+ * @param value exponent, used by the generic class
+ * @param x base
+ * @param sq sq[b] = x^(2^b)
+ * @param root sqrt(x), used by the half-integer class
+ */
+static inline real_t fas_pow_from_squares(idx_t pow_class, idx_t pow_n,
+  real_t value, real_t x, const real_t * sq, real_t root)
+{
+  if(pow_class == FASMultigrid::pow_generic)
+    return pow(x, value);
+
+  idx_t m = std::abs(pow_n);
+  real_t r = 1.0;
+  if(pow_class == FASMultigrid::pow_half_integer)
+  {
+    r = root;
+    m >>= 1;
+  }
+  for(idx_t b = 0; m > 0; b++, m >>= 1)
+    if(m & 1)
+      r *= sq[b];
+
+  return (pow_n < 0) ? 1.0 / r : r;
+}
+
+/**
+ * @brief x^value for a single, unshared power
+ */
+static inline real_t fas_pow(idx_t pow_class, idx_t pow_n, real_t value, real_t x)
+{
+  if(pow_class == FASMultigrid::pow_generic)
+    return pow(x, value);
+
+  real_t sq[FAS_MAX_POW_BITS];
+  sq[0] = x;
+  for(idx_t b = 1; b < FAS_MAX_POW_BITS; b++)
+    sq[b] = sq[b-1] * sq[b-1];
+
+  return fas_pow_from_squares(pow_class, pow_n, value, x, sq,
+    (pow_class == FASMultigrid::pow_half_integer) ? std::sqrt(x) : 0.0);
+}
+
+/**
+ * @brief dot product of two vectors
+ */
+static real_t fas_dot(const std::vector<real_t> & a, const std::vector<real_t> & b)
+{
+  real_t sum = 0.0;
+  idx_t n = a.size();
+  #pragma omp parallel for reduction(+:sum)
+  for(idx_t l = 0; l < n; l++)
+    sum += a[l] * b[l];
+  return sum;
+}
+
+/**
+ * @brief y += alpha * x
+ */
+static void fas_axpy(std::vector<real_t> & y, real_t alpha, const std::vector<real_t> & x)
+{
+  idx_t n = y.size();
+  #pragma omp parallel for
+  for(idx_t l = 0; l < n; l++)
+    y[l] += alpha * x[l];
+}
+
+/**
+ * @brief x *= alpha
+ */
+static void fas_scale(std::vector<real_t> & x, real_t alpha)
+{
+  idx_t n = x.size();
+  #pragma omp parallel for
+  for(idx_t l = 0; l < n; l++)
+    x[l] *= alpha;
+}
+
 /**
  * @brief Method to initialize internal variables, allocate memory
  * @param[in]  input arrays, has its initial value at finest grid, so need no memory
@@ -12,18 +97,30 @@ namespace cosmo
  * @param[in]  set how many layers we want
  * @param[in]  set number of interations for each relaxation
  * @param[in]  set relaxation jump out precision
+ * @param[in]  length of box in x, y and z direction, H_LEN_FRAC if NULL
+ * @param[in]  whether to coarsen strongly coupled directions only
+ * @param[in]  coarsest depth, raised if grids cannot be coarsened that often
  */
 FASMultigrid::FASMultigrid(fas_heirarchy_t u_in, idx_t u_n_in, idx_t molecule_n_in [],
-              idx_t max_depth_in, idx_t max_relax_iters_in,  real_t relaxation_tolerance_in)
+              idx_t max_depth_in, idx_t max_relax_iters_in,  real_t relaxation_tolerance_in,
+              const real_t * box_len_in, bool semi_coarsening_in, idx_t min_depth_in)
 {
   relax_scheme = relax_t::inexact_newton;
 
   max_relax_iters = max_relax_iters_in;
   max_depth = max_depth_in;
-  min_depth = 1;
-  max_depth_idx = _dIdx(max_depth);
-  min_depth_idx = _dIdx(min_depth);
-  total_depths = max_depth - min_depth + 1;
+  min_depth = min_depth_in;
+  if(min_depth < 1 || min_depth > max_depth)
+  {
+    std::cout << "Invalid min. depth " << min_depth << " for max. depth "
+      << max_depth << ".\n";
+    throw -1;
+  }
+  for(idx_t d = 0; d < 3; d++)
+    box_len[d] = (box_len_in != NULL) ? box_len_in[d] : H_LEN_FRAC;
+  semi_coarsening = semi_coarsening_in;
+  line_axis = 0;
+  _planLevels();
   relaxation_tolerance = relaxation_tolerance_in;
   u_n = u_n_in;
   
@@ -34,10 +131,65 @@ FASMultigrid::FASMultigrid(fas_heirarchy_t u_in, idx_t u_n_in, idx_t molecule_n_
   damping_v_h = new fas_heirarchy_t[u_n_in];
   jac_rhs_h = new fas_heirarchy_t[u_n_in];
   tmp_h = new fas_heirarchy_t[u_n_in];
+  coarse_appx_h = new fas_heirarchy_t[u_n_in];
 
   eqns = new molecule *[u_n_in];
 
   rho_h = new fas_heirarchy_set_t[u_n];
+
+  tapes = new equation_tape[total_depths];
+  tapes_compiled = false;
+
+  padded_tapes = new equation_tape[total_depths];
+  padded_active = new bool[total_depths];
+  for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+    padded_active[depth_idx] = false;
+  padded_layout = true;
+
+  eqn_kernels = new FASEquationKernel *[u_n];
+  jit_kernels = new FASJITEquationKernel *[u_n];
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    eqn_kernels[eqn_id] = jit_kernels[eqn_id] = NULL;
+  jit = NULL;
+
+  linearizations = new frozen_linearization[total_depths];
+  for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+    linearizations[depth_idx].stored = false;
+  linearization_budget = 0;
+  linearization_lines = false;
+
+  newton_krylov_dim = 10;
+  newton_max_restarts = 4;
+  newton_precond_cycles = 2;
+  newton_smooth_sweeps = 2;
+  newton_coarse_sweeps = 10;
+  newton_forcing = 0.1;
+
+  line_search = line_search_armijo;
+  line_search_candidates = 4;
+  line_search_max_evaluations = 20;
+  line_search_c = 1e-4;
+  line_search_evaluations = 0;
+
+  fmg_coarse_relax_iters = 20 * max_relax_iters;
+
+  coarse_solver = coarse_direct;
+  coarse_direct_max_unknowns = 512;
+  coarse_newton_iters = 20;
+
+  solve_stagnation_factor = 0.95;
+  solve_stagnation_cycles = 2;
+  solve_divergence_ratio = 1e3;
+
+  // V-cycle, smoothing before coarse grid correction only on finest grid
+  cycle_cfg.type = v_cycle;
+  cycle_cfg.gamma = 1;
+  cycle_cfg.pre_relax.assign(total_depths, 0);
+  cycle_cfg.pre_relax[max_depth_idx] = max_relax_iters;
+  cycle_cfg.post_relax.assign(total_depths, max_relax_iters);
+  cycle_cfg.coarse_relax = max_relax_iters;
+  cycle_cfg.restriction.assign(total_depths, restrict_full_weighting);
+  cycle_cfg.prolongation.assign(total_depths, prolong_trilinear);
   
   for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
   {
@@ -46,12 +198,9 @@ FASMultigrid::FASMultigrid(fas_heirarchy_t u_in, idx_t u_n_in, idx_t molecule_n_
     damping_v_h[eqn_id] = new fas_grid_t[total_depths];
     jac_rhs_h[eqn_id] = new fas_grid_t[total_depths];
     tmp_h[eqn_id] = new fas_grid_t[total_depths];
+    coarse_appx_h[eqn_id] = new fas_grid_t[total_depths];
     
     rho_h[eqn_id] = new fas_heirarchy_t[molecule_n[eqn_id]];
-    
-    nx_h = new idx_t[total_depths];
-    ny_h = new idx_t[total_depths];
-    nz_h = new idx_t[total_depths];
 
     eqns[eqn_id] = new molecule[molecule_n[eqn_id]]; 
     
@@ -62,23 +211,13 @@ FASMultigrid::FASMultigrid(fas_heirarchy_t u_in, idx_t u_n_in, idx_t molecule_n_
       {
         u_h[eqn_id][depth_idx]._array = u_in[eqn_id]._array;
 
-        nx_h[depth_idx] = NX;
-        ny_h[depth_idx] = NY;
-        nz_h[depth_idx] = NZ;
-        
         u_h[eqn_id][depth_idx].nx = nx_h[depth_idx];
         u_h[eqn_id][depth_idx].ny = ny_h[depth_idx];
         u_h[eqn_id][depth_idx].nz = nz_h[depth_idx];
         u_h[eqn_id][depth_idx].pts = nx_h[depth_idx] * ny_h[depth_idx] * nz_h[depth_idx];
       }
       else
-      {
-        nx_h[depth_idx] = nx_h[depth_idx+1] / 2 + (nx_h[depth_idx+1] % 2);
-        ny_h[depth_idx] = ny_h[depth_idx+1] / 2 + (ny_h[depth_idx+1] % 2);
-        nz_h[depth_idx] = nz_h[depth_idx+1] / 2 + (nz_h[depth_idx+1] % 2);
-
         u_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
-      }
       
       coarse_src_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
 
@@ -86,12 +225,25 @@ FASMultigrid::FASMultigrid(fas_heirarchy_t u_in, idx_t u_n_in, idx_t molecule_n_
       
       jac_rhs_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
 
-      tmp_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+      // the finest tmp is only needed by the Newton preconditioner,
+      // see _linearCorrectionCycle()
+      if(depth != max_depth)
+        tmp_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+
+      if(depth != max_depth)
+        coarse_appx_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
     }
 
     for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
       rho_h[eqn_id][mol_id] = new fas_grid_t[total_depths];
   }
+
+  tilings = new fas_tiling[total_depths];
+  tile_cache_bytes = 256 * 1024;
+  _planTilings();
+
+  jacobi_fused_sweeps = 1;
+  concurrent_equations = false;
   
   // initializing x, y and z derivative
   der_type[der1][0] = 1;
@@ -118,867 +270,3935 @@ FASMultigrid::FASMultigrid(fas_heirarchy_t u_in, idx_t u_n_in, idx_t molecule_n_
   der_type[der23][1] = 3;
 
   // type == 11 means laplacian!
-
-  // initilizing coeficient of double derivative for different sencil orders
-  double_der_coef[2] = 2.0;
-  double_der_coef[4] = 2.5;
-  double_der_coef[6] = 49.0 / 18.0;
-  double_der_coef[8] = 205.0 / 72.0;
 }
 
 
+/**
+ * @brief plan grid sizes of all depths
+ * @details Going coarser from the NX * NY * NZ finest grid, each axis
+ *  is halved as long as it has an even number of points and keeps at
+ *  least FAS_MIN_AXIS_POINTS; otherwise that axis is not coarsened any
+ *  more (e.g. 96 -> 48 -> 24 -> 12 -> 6 -> 3 -> 3). With semi-coarsening
+ *  only strongly coupled axes are coarsened, those with a spacing less
+ *  than twice the smallest one, unless none of them can be. Once no
+ *  axis can be coarsened, further depths would repeat the same grid, so
+ *  min_depth is raised instead.
+ */
+void FASMultigrid::_planLevels()
+{
+  std::vector<idx_t> nx(1, NX), ny(1, NY), nz(1, NZ); // finest first
+
+  while((idx_t) nx.size() < max_depth - min_depth + 1)
+  {
+    idx_t n[3] = { nx.back(), ny.back(), nz.back() };
+    bool can_coarsen[3], strong[3];
+    real_t h_min = box_len[0] / n[0];
+    for(idx_t d = 0; d < 3; d++)
+    {
+      can_coarsen[d] = (n[d] % 2 == 0 && n[d] / 2 >= FAS_MIN_AXIS_POINTS);
+      h_min = std::min(h_min, box_len[d] / n[d]);
+    }
+    bool any_strong = false, any = false;
+    for(idx_t d = 0; d < 3; d++)
+    {
+      strong[d] = !semi_coarsening || box_len[d] / n[d] < 2.0 * h_min;
+      any_strong = any_strong || (strong[d] && can_coarsen[d]);
+      any = any || can_coarsen[d];
+    }
+    if(!any)
+      break;
+    for(idx_t d = 0; d < 3; d++)
+      if(can_coarsen[d] && (strong[d] || !any_strong))
+        n[d] /= 2;
+    nx.push_back(n[0]);
+    ny.push_back(n[1]);
+    nz.push_back(n[2]);
+  }
+
+  if((idx_t) nx.size() < max_depth - min_depth + 1)
+  {
+    min_depth = max_depth - (idx_t) nx.size() + 1;
+    std::cout << "Grid cannot be coarsened further than " << nx.back() << " x "
+      << ny.back() << " x " << nz.back() << "; using min. depth " << min_depth << ".\n";
+  }
+
+  max_depth_idx = _dIdx(max_depth);
+  min_depth_idx = _dIdx(min_depth);
+  total_depths = max_depth - min_depth + 1;
+
+  nx_h = new idx_t[total_depths];
+  ny_h = new idx_t[total_depths];
+  nz_h = new idx_t[total_depths];
+  rx_h = new idx_t[total_depths];
+  ry_h = new idx_t[total_depths];
+  rz_h = new idx_t[total_depths];
+
+  for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+  {
+    nx_h[depth_idx] = nx[max_depth_idx - depth_idx];
+    ny_h[depth_idx] = ny[max_depth_idx - depth_idx];
+    nz_h[depth_idx] = nz[max_depth_idx - depth_idx];
+    rx_h[depth_idx] = depth_idx > 0 ? nx_h[depth_idx] / nx_h[depth_idx-1] : 1;
+    ry_h[depth_idx] = depth_idx > 0 ? ny_h[depth_idx] / ny_h[depth_idx-1] : 1;
+    rz_h[depth_idx] = depth_idx > 0 ? nz_h[depth_idx] / nz_h[depth_idx-1] : 1;
+  }
+}
+
 void FASMultigrid::add_atom_to_eqn(atom atom_in, idx_t molecule_id, idx_t eqn_id)
 {
+  _classifyExponent(atom_in.value, atom_in.pow_class, atom_in.pow_n);
   eqns[eqn_id][molecule_id].add_atom(atom_in);
+  tapes_compiled = false;
+
+  // compiled kernels no longer match the equations
+  _disableKernelJIT();
 }
 
 /**
- * @brief evaluating the value of equation at a point
- * @param[in]  id of equation to calculate
- * @param[in]  index of depth
- * @param[in]  index of x direction
- * @param[in]  index of y direction
- * @param[in]  index of z direction
+ * @brief classify the exponent of a polynomial atom
+ * @details integer and half-integer exponents up to FAS_MAX_POW_INT are
+ *  evaluated with multiplication chains (and a square root), anything
+ *  else with pow()
+ *
+ * @param value exponent
+ * @param pow_class set to class of exponent (see pow_class_t)
+ * @param pow_n set to exponent for integer class, twice the exponent
+ *  for half-integer class
  */
-real_t FASMultigrid::_evaluateEllipticEquationPt(idx_t eqn_id, idx_t depth_idx,
-  idx_t i, idx_t j, idx_t k)
+void FASMultigrid::_classifyExponent(real_t value, idx_t & pow_class, idx_t & pow_n)
 {
-  real_t res = 0.0;
-   
-  for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+  pow_class = pow_generic;
+  pow_n = 0;
+
+  if(std::fabs(value) > FAS_MAX_POW_INT)
+    return;
+
+  if(value == std::floor(value))
   {
-    // value will end up being the value of a particular term in an equation
-    real_t val = eqns[eqn_id][mol_id].const_coef;
-    real_t pos_idx = H_INDEX(i, j, k,
-       nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+    pow_class = pow_integer;
+    pow_n = (idx_t) value;
+  }
+  else if(2.0 * value == std::floor(2.0 * value))
+  {
+    pow_class = pow_half_integer;
+    pow_n = (idx_t) (2.0 * value);
+  }
+}
 
-    if(rho_h[eqn_id][mol_id][depth_idx].pts > 0) // constant
-      val *= rho_h[eqn_id][mol_id][depth_idx][pos_idx];
-    
-    
-    for(idx_t atom_id = 0; atom_id < eqns[eqn_id][mol_id].atom_n; atom_id++)
-    {
-      atom & ad = eqns[eqn_id][mol_id].atoms[atom_id];
-      
-      if(ad.type == 1) // polynomial type
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        val *= pow(vd[pos_idx], ad.value);
-      }
-      else if(ad.type <= 4) // first derivative type
+/**
+ * @brief append stencil taps of a derivative / laplacian atom
+ * @details weights include the grid spacing
+ *
+ * @param taps list to append to
+ * @param type atom type
+ * @param h grid spacing in direction 1, 2 and 3 (h[0] unused)
+ */
+void FASMultigrid::_appendAtomTaps(std::vector<tape_tap> & taps, idx_t type, const real_t h[4])
+{
+  const idx_t R = STENCIL_ORDER / 2;
+
+  tape_tap tap;
+  tap.off = 0; // set by _compilePaddedTape()
+
+  if(type <= der3) // first derivative type
+  {
+    idx_t d = der_type[type][0];
+    for(idx_t o = 1; o <= R; o++)
+      for(idx_t s = -1; s <= 1; s += 2)
       {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        val *= derivative(i, j, k, vd.nx, vd.ny, vd.nz,
-          der_type[ad.type][0], vd);
+        tap.di = (d == 1) * s * o;
+        tap.dj = (d == 2) * s * o;
+        tap.dk = (d == 3) * s * o;
+        tap.coef = s * fas_der1_coef[R][o] / h[d];
+        taps.push_back(tap);
       }
-      else if(ad.type <= 10)
+  }
+  else if(type <= der33) // unmixed double derivative
+  {
+    idx_t d = der_type[type][0];
+    for(idx_t o = -R; o <= R; o++)
+    {
+      tap.di = (d == 1) * o;
+      tap.dj = (d == 2) * o;
+      tap.dk = (d == 3) * o;
+      tap.coef = fas_der2_coef[R][std::abs(o)] / (h[d] * h[d]);
+      taps.push_back(tap);
+    }
+  }
+  else if(type <= der23) // mixed double derivative
+  {
+    idx_t d1 = der_type[type][0], d2 = der_type[type][1];
+    for(idx_t o1 = -R; o1 <= R; o1++)
+      for(idx_t o2 = -R; o2 <= R; o2++)
       {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        val *= double_derivative(i, j, k, vd.nx, vd.ny, vd.nz,
-          der_type[ad.type][0], der_type[ad.type][1], vd);
+        if(o1 == 0 || o2 == 0)
+          continue;
+        tap.di = (d1 == 1) * o1 + (d2 == 1) * o2;
+        tap.dj = (d1 == 2) * o1 + (d2 == 2) * o2;
+        tap.dk = (d1 == 3) * o1 + (d2 == 3) * o2;
+        tap.coef = _sign(o1) * fas_der1_coef[R][std::abs(o1)]
+          * _sign(o2) * fas_der1_coef[R][std::abs(o2)] / (h[d1] * h[d2]);
+        taps.push_back(tap);
       }
-      else
+  }
+  else // laplacian
+  {
+    tap.di = tap.dj = tap.dk = 0;
+    tap.coef = 0.0;
+    for(idx_t d = 1; d <= 3; d++)
+      tap.coef += fas_der2_coef[R][0] / (h[d] * h[d]);
+    taps.push_back(tap);
+
+    for(idx_t d = 1; d <= 3; d++)
+      for(idx_t o = -R; o <= R; o++)
       {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        val *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
+        if(o == 0)
+          continue;
+        tap.di = (d == 1) * o;
+        tap.dj = (d == 2) * o;
+        tap.dk = (d == 3) * o;
+        tap.coef = fas_der2_coef[R][std::abs(o)] / (h[d] * h[d]);
+        taps.push_back(tap);
       }
-    }
-    res += val;
   }
-  return res;
 }
 
 /**
- * @brief evaluate value of v * \partial F(u) / \partial u, storing coefficient a and b for interation
- *
- * @param id of equation which needs to be calculated
- * @param index of depth
- * @param coeficient a, stores the right hand side of iteration equation
- * @param coeficient b, stores the left hand coefficient for iteration
- * @param x grid index
- * @param y grid index
- * @param z grid index
- * @param id of variable in differentiation
+ * @brief lower "molecules" and "atoms" of all equations into a flat
+ *  evaluation tape at every depth
+ * @details needs to be called after all atoms are added and source
+ *  terms are allocated; initializeRhoHeirarchy() does this.
  */
-void FASMultigrid::_evaluateIterationForJacEquation(idx_t eqn_id,
-  idx_t depth_idx, real_t &coef_a, real_t &coef_b,
-  idx_t i, idx_t j, idx_t k, idx_t u_id)
+void FASMultigrid::_compileEquationTapes()
 {
-  real_t dx = H_LEN_FRAC / (real_t)nx_h[depth_idx];
+  const idx_t R = STENCIL_ORDER / 2;
 
-  // Currently can only deal with the case dx = dy = dz, needs to be generilized
-  
-  for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+  for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
   {
-    real_t mol_to_a = 0.0, mol_to_b = 0.0;
-    real_t non_der_val = eqns[eqn_id][mol_id].const_coef;
-    real_t pos_idx = H_INDEX(i,j,k,nx_h[depth_idx],ny_h[depth_idx],nz_h[depth_idx]);
+    equation_tape & tape = tapes[depth_idx];
+    idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+    real_t h[4] = { 0.0, box_len[0] / (real_t)nx,
+      box_len[1] / (real_t)ny, box_len[2] / (real_t)nz };
+
+    tape.linear = false;
+    tape.taps.clear();
+    tape.ops.clear();
+    tape.mols.clear();
+    tape.eqn_mol_begin.assign(u_n + 1, 0);
+
+    // periodically wrapped offsets, so that H_INDEX(i+di, j+dj, k+dk)
+    // becomes xo[i+di] + yo[j+dj] + zo[k+dk] for |d| <= R
+    tape.x_off.resize(nx + 2*R);
+    tape.y_off.resize(ny + 2*R);
+    tape.z_off.resize(nz + 2*R);
+    for(idx_t i = -R; i < nx + R; i++)
+      tape.x_off[i + R] = ((i % nx + nx) % nx) * ny * nz;
+    for(idx_t j = -R; j < ny + R; j++)
+      tape.y_off[j + R] = ((j % ny + ny) % ny) * nz;
+    for(idx_t k = -R; k < nz + R; k++)
+      tape.z_off[k + R] = (k % nz + nz) % nz;
+    tape.xo = &tape.x_off[R];
+    tape.yo = &tape.y_off[R];
+    tape.zo = &tape.z_off[R];
+
+    tape.pows.clear();
+    tape.pow_groups.clear();
+    tape.eqn_pow_begin.assign(u_n + 1, 0);
+    tape.eqn_group_begin.assign(u_n + 1, 0);
 
-    if(rho_h[eqn_id][mol_id][depth_idx].pts > 0) // constant
-     non_der_val *= rho_h[eqn_id][mol_id][depth_idx][pos_idx];
-
-    // pre_val to help keep track of the result of terms with only one derivative
-    for(idx_t atom_id = 0; atom_id < eqns[eqn_id][mol_id].atom_n; atom_id++)
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
     {
-      atom & ad =  eqns[eqn_id][mol_id].atoms[atom_id];
-      
-      if(ad.type == 1) // polynomial type
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        if(u_id == ad.u_id)
-        {
-          mol_to_b = mol_to_b * pow(vd[pos_idx], ad.value)
-            + non_der_val * ad.value * pow(vd[pos_idx], ad.value-1.0);
-          non_der_val = non_der_val * pow(vd[pos_idx], ad.value);
-          mol_to_a *= pow(vd[pos_idx], ad.value);
-        }
-        else
-        {
-          mol_to_b *= pow(vd[pos_idx], ad.value);
-          mol_to_a *= pow(vd[pos_idx], ad.value);
-          non_der_val *= pow(vd[pos_idx], ad.value);
-        }
-      }
-      else if(ad.type <= 4) // first derivative type
+      tape.eqn_mol_begin[eqn_id] = tape.mols.size();
+      tape.eqn_pow_begin[eqn_id] = tape.pows.size();
+      tape.eqn_group_begin[eqn_id] = tape.pow_groups.size();
+
+      // merge polynomial atoms of the same variable within each term,
+      // u^a * u^b = u^(a+b)
+      std::vector< std::vector<idx_t> > poly_u(molecule_n[eqn_id]);
+      std::vector< std::vector<real_t> > poly_value(molecule_n[eqn_id]);
+      for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
       {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
-        if(u_id == ad.u_id)
+        molecule & mol = eqns[eqn_id][mol_id];
+        for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
         {
-          mol_to_a = mol_to_a * derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd)
-            + non_der_val * derivative(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, der_type[ad.type][0], jac_vd);
-          mol_to_b = mol_to_b * derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-          non_der_val =non_der_val * derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-        }
-        else
-        {
-          non_der_val *= derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-          mol_to_b *= derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-          mol_to_a *= derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
+          atom & ad = mol.atoms[atom_id];
+          if(ad.type != poly)
+            continue;
+
+          idx_t f = 0;
+          while(f < (idx_t) poly_u[mol_id].size() && poly_u[mol_id][f] != ad.u_id)
+            f++;
+          if(f == (idx_t) poly_u[mol_id].size())
+          {
+            poly_u[mol_id].push_back(ad.u_id);
+            poly_value[mol_id].push_back(0.0);
+          }
+          poly_value[mol_id][f] += ad.value;
         }
       }
-      else if(ad.type <= 10)
+
+      // powers shared by all terms, grouped by variable so that each
+      // group needs a single set of squarings; powers lowered by one
+      // are only needed for the Jacobian
+      for(idx_t u_id = 0; u_id < u_n; u_id++)
       {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
+        std::vector<real_t> val_values, der_values;
+        for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+          for(idx_t f = 0; f < (idx_t) poly_u[mol_id].size(); f++)
+          {
+            if(poly_u[mol_id][f] != u_id)
+              continue;
+            real_t value = poly_value[mol_id][f];
+            if(std::find(val_values.begin(), val_values.end(), value) == val_values.end())
+              val_values.push_back(value);
+            if(std::find(der_values.begin(), der_values.end(), value - 1.0) == der_values.end())
+              der_values.push_back(value - 1.0);
+          }
 
-        if(u_id == ad.u_id)
-        {
-          mol_to_a = mol_to_a * double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd)
-            + non_der_val * (double_derivative(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, der_type[ad.type][0], der_type[ad.type][1], jac_vd) +
-                             (ad.type <= 7) * double_der_coef[STENCIL_ORDER] * jac_vd[pos_idx] / (dx*dx));
-          mol_to_b = mol_to_b * double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd)
-            - (ad.type <= 7) * non_der_val * double_der_coef[STENCIL_ORDER]/(dx * dx);
-          non_der_val = non_der_val * double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-        }
-        else
+        idx_t n_slots = tape.pows.size() - tape.eqn_pow_begin[eqn_id];
+        if(val_values.empty()
+            || n_slots + val_values.size() + der_values.size() > FAS_MAX_POW_SLOTS)
+          continue;
+
+        tape_pow_group group;
+        group.u = u_h[u_id][depth_idx]._array;
+        group.n_squares = 0;
+        group.need_root = false;
+
+        for(idx_t pass = 0; pass < 2; pass++)
         {
-          non_der_val *= double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-          mol_to_a *= double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-          mol_to_b *= double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
+          std::vector<real_t> & values = (pass == 0) ? val_values : der_values;
+          idx_t begin = tape.pows.size() - tape.eqn_pow_begin[eqn_id];
+          for(idx_t v = 0; v < (idx_t) values.size(); v++)
+          {
+            tape_pow tp;
+            tp.value = values[v];
+            _classifyExponent(tp.value, tp.pow_class, tp.pow_n);
+            tape.pows.push_back(tp);
+
+            idx_t m = std::abs(tp.pow_n);
+            if(tp.pow_class == pow_half_integer)
+            {
+              group.need_root = true;
+              m >>= 1;
+            }
+            idx_t bits = 0;
+            for(; m > 0; m >>= 1)
+              bits++;
+            group.n_squares = std::max(group.n_squares, bits);
+          }
+          idx_t end = tape.pows.size() - tape.eqn_pow_begin[eqn_id];
+          if(pass == 0)
+          {
+            group.val_begin = begin;
+            group.val_end = end;
+          }
+          else
+          {
+            group.der_begin = begin;
+            group.der_end = end;
+          }
         }
+
+        tape.pow_groups.push_back(group);
       }
-      else
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
 
-        if(u_id == ad.u_id)
+      for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+      {
+        molecule & mol = eqns[eqn_id][mol_id];
+        tape_mol tm;
+        tm.const_coef = mol.const_coef;
+        tm.rho = (rho_h[eqn_id][mol_id][depth_idx].pts > 0) ?
+          rho_h[eqn_id][mol_id][depth_idx]._array : NULL;
+
+        // polynomial ops first, then stencil ops
+        tm.poly_begin = tape.ops.size();
+        for(idx_t f = 0; f < (idx_t) poly_u[mol_id].size(); f++)
         {
-          mol_to_a = mol_to_a * laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, vd)
-            + non_der_val * (laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, jac_vd) + 3.0 * double_der_coef[STENCIL_ORDER] * jac_vd[pos_idx] / (dx * dx));
-          mol_to_b = mol_to_b * laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, vd)
-            - non_der_val * 3.0 * double_der_coef[STENCIL_ORDER] / (dx*dx);
-          non_der_val = non_der_val * laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, vd);
+          tape_op op;
+          op.u_id = poly_u[mol_id][f];
+          op.type = poly;
+          op.value = poly_value[mol_id][f];
+          _classifyExponent(op.value, op.pow_class, op.pow_n);
+          op.u = u_h[op.u_id][depth_idx]._array;
+          op.v = damping_v_h[op.u_id][depth_idx]._array;
+          op.tap_begin = op.tap_end = tape.taps.size();
+          op.center_coef = 1.0;
+
+          // look up shared slots
+          op.slot = op.der_slot = -1;
+          for(idx_t s = tape.eqn_pow_begin[eqn_id]; s < (idx_t) tape.pows.size(); s++)
+          {
+            idx_t local = s - tape.eqn_pow_begin[eqn_id];
+            for(idx_t g = tape.eqn_group_begin[eqn_id]; g < (idx_t) tape.pow_groups.size(); g++)
+            {
+              tape_pow_group & group = tape.pow_groups[g];
+              if(group.u != op.u)
+                continue;
+              if(local >= group.val_begin && local < group.val_end
+                  && tape.pows[s].value == op.value)
+                op.slot = local;
+              if(local >= group.der_begin && local < group.der_end
+                  && tape.pows[s].value == op.value - 1.0)
+                op.der_slot = local;
+            }
+          }
+
+          tape.ops.push_back(op);
         }
-        else
+        tm.poly_end = tm.sten_begin = tape.ops.size();
+        for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
         {
-          non_der_val *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
-          mol_to_a *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
-          mol_to_b *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
+          atom & ad = mol.atoms[atom_id];
+          if(ad.type == poly)
+            continue;
+
+          tape_op op;
+          op.u_id = ad.u_id;
+          op.type = ad.type;
+          op.value = 1.0;
+          op.slot = op.der_slot = -1;
+          op.pow_class = pow_integer;
+          op.pow_n = 1;
+          op.u = u_h[ad.u_id][depth_idx]._array;
+          op.v = damping_v_h[ad.u_id][depth_idx]._array;
+          op.tap_begin = tape.taps.size();
+          _appendAtomTaps(tape.taps, ad.type, h);
+          op.tap_end = tape.taps.size();
+
+          op.center_coef = 0.0;
+          for(idx_t t = op.tap_begin; t < op.tap_end; t++)
+            if(tape.taps[t].di == 0 && tape.taps[t].dj == 0 && tape.taps[t].dk == 0)
+              op.center_coef += tape.taps[t].coef;
+          tape.ops.push_back(op);
         }
+        tm.sten_end = tape.ops.size();
+
+        tape.mols.push_back(tm);
       }
     }
-    coef_a += mol_to_a;
-    coef_b += mol_to_b;
+    tape.eqn_mol_begin[u_n] = tape.mols.size();
+    tape.eqn_pow_begin[u_n] = tape.pows.size();
+    tape.eqn_group_begin[u_n] = tape.pow_groups.size();
+
+    // stencil shape, determines point colouring of Gauss-Seidel sweeps
+    tape.radius = 0;
+    tape.mixed = false;
+    for(idx_t t = 0; t < (idx_t) tape.taps.size(); t++)
+    {
+      tape_tap & tp = tape.taps[t];
+      tape.radius = std::max(tape.radius,
+        std::max(std::abs(tp.di), std::max(std::abs(tp.dj), std::abs(tp.dk))));
+      if((tp.di != 0) + (tp.dj != 0) + (tp.dk != 0) > 1)
+        tape.mixed = true;
+    }
+
+    // context for specialized equation kernels
+    tape.u_ptrs.resize(u_n);
+    tape.v_ptrs.resize(u_n);
+    for(idx_t u_id = 0; u_id < u_n; u_id++)
+    {
+      tape.u_ptrs[u_id] = u_h[u_id][depth_idx]._array;
+      tape.v_ptrs[u_id] = damping_v_h[u_id][depth_idx]._array;
+    }
+    tape.rho_ptrs.resize(tape.mols.size());
+    for(idx_t m = 0; m < (idx_t) tape.mols.size(); m++)
+      tape.rho_ptrs[m] = tape.mols[m].rho;
+
+    tape.ctx.resize(u_n);
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    {
+      fas_kernel_ctx & ctx = tape.ctx[eqn_id];
+      ctx.u = &tape.u_ptrs[0];
+      ctx.v = &tape.v_ptrs[0];
+      ctx.rho = tape.rho_ptrs.data() + tape.eqn_mol_begin[eqn_id];
+      ctx.xo = tape.xo;
+      ctx.yo = tape.yo;
+      ctx.zo = tape.zo;
+      for(idx_t d = 0; d < 3; d++)
+        ctx.inv_h[d] = 1.0 / h[d+1];
+    }
+
+    if(padded_layout)
+      _compilePaddedTape(depth_idx);
   }
 
-  return;
+  tapes_compiled = true;
+  _syncPaddedSources();
+
+  // stencil radii are known now
+  _planTilings();
+
+  _planLinearizationStorage();
 }
 
 /**
- * @brief evaluate value of v * \partial F(u) / \partial u
+ * @brief derive tape of padded grids from tape of a depth
+ * @details Padded grids mirror u, v and rho with ghost layers of width
+ *  STENCIL_ORDER/2 holding periodic images, so that a neighbour of
+ *  idx is simply idx + tap offset and offset tables are linear.
+ *  Mirrors of u and v are refreshed by _beginPaddedSweep(), mirrors of
+ *  rho by _syncPaddedSources().
  *
- * @param id of equation which needs to be calculated
- * @param index of depth
- * @param coeficient a, stores the right hand side of iteration equation
- * @param coeficient b, stores the left hand coefficient for iteration
- * @param x grid index
- * @param y grid index
- * @param z grid index
- * @param id of variable in differentiation
- */    
-real_t FASMultigrid::_evaluateDerEllipticEquation(idx_t eqn_id, idx_t depth_idx, idx_t i, idx_t j, idx_t k, idx_t u_id)
+ * @param depth_idx index of depth
+ */
+void FASMultigrid::_compilePaddedTape(idx_t depth_idx)
 {
-  real_t res = 0.0;
-  for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+  const idx_t R = STENCIL_ORDER / 2;
+  equation_tape & tape = tapes[depth_idx];
+  equation_tape & pt = padded_tapes[depth_idx];
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  idx_t pny = ny + 2*R, pnz = nz + 2*R;
+  idx_t pts = (nx + 2*R) * pny * pnz;
+
+  pt = tape;
+  pt.linear = true;
+
+  for(idx_t i = -R; i < nx + R; i++)
+    pt.x_off[i + R] = (i + R) * pny * pnz;
+  for(idx_t j = -R; j < ny + R; j++)
+    pt.y_off[j + R] = (j + R) * pnz;
+  for(idx_t k = -R; k < nz + R; k++)
+    pt.z_off[k + R] = k + R;
+  pt.xo = &pt.x_off[R];
+  pt.yo = &pt.y_off[R];
+  pt.zo = &pt.z_off[R];
+
+  for(idx_t t = 0; t < (idx_t) pt.taps.size(); t++)
+    pt.taps[t].off = pt.taps[t].di * pny * pnz + pt.taps[t].dj * pnz + pt.taps[t].dk;
+
+  pt.pad_u.assign(u_n, std::vector<real_t>(pts));
+  pt.pad_v.assign(u_n, std::vector<real_t>(pts));
+  pt.pad_rho.assign(pt.mols.size(), std::vector<real_t>());
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
   {
-    real_t non_der_val = eqns[eqn_id][mol_id].const_coef, der_val = 0.0;
-    // pre_val to help keep track of the result of terms with only one derivative
-
-    real_t pos_idx = H_INDEX(i,j,k,nx_h[depth_idx],ny_h[depth_idx],nz_h[depth_idx]);
-
-    if(rho_h[eqn_id][mol_id][depth_idx].pts > 0) // constant
-      non_der_val *= rho_h[eqn_id][mol_id][depth_idx][pos_idx];
-
-    for(idx_t atom_id = 0; atom_id < eqns[eqn_id][mol_id].atom_n; atom_id++)
+    pt.u_ptrs[u_id] = &pt.pad_u[u_id][0];
+    pt.v_ptrs[u_id] = &pt.pad_v[u_id][0];
+  }
+  for(idx_t m = 0; m < (idx_t) pt.mols.size(); m++)
+  {
+    if(pt.mols[m].rho != NULL)
     {
-      atom & ad =  eqns[eqn_id][mol_id].atoms[atom_id];
+      pt.pad_rho[m].resize(pts);
+      pt.mols[m].rho = &pt.pad_rho[m][0];
+    }
+    pt.rho_ptrs[m] = pt.mols[m].rho;
+  }
+  for(idx_t o = 0; o < (idx_t) pt.ops.size(); o++)
+  {
+    pt.ops[o].u = pt.u_ptrs[pt.ops[o].u_id];
+    pt.ops[o].v = pt.v_ptrs[pt.ops[o].u_id];
+  }
+  for(idx_t g = 0; g < (idx_t) pt.pow_groups.size(); g++)
+    for(idx_t u_id = 0; u_id < u_n; u_id++)
+      if(pt.pow_groups[g].u == tape.u_ptrs[u_id])
+        pt.pow_groups[g].u = pt.u_ptrs[u_id];
 
-      if(ad.type == 1) // polynomial type
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
-        if(u_id == ad.u_id)
-        {
-          der_val = non_der_val * ad.value * pow(vd[pos_idx], ad.value-1.0) * jac_vd[pos_idx]
-            + der_val * pow(vd[pos_idx], ad.value);
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    fas_kernel_ctx & ctx = pt.ctx[eqn_id];
+    ctx.u = &pt.u_ptrs[0];
+    ctx.v = &pt.v_ptrs[0];
+    ctx.rho = pt.rho_ptrs.data() + pt.eqn_mol_begin[eqn_id];
+    ctx.xo = pt.xo;
+    ctx.yo = pt.yo;
+    ctx.zo = pt.zo;
+  }
 
-          non_der_val = non_der_val * pow(vd[pos_idx], ad.value);
-        }
-        else
-        {
-          non_der_val *= pow(vd[pos_idx], ad.value);
-          der_val *= pow(vd[pos_idx], ad.value);
-        }
-      }
-      else if(ad.type <= 4)// first derivative type
-      {
-        fas_grid_t & vd = u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd = damping_v_h[u_id][depth_idx];
-        if(u_id == ad.u_id)
-        {
-          der_val = non_der_val * derivative(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, der_type[ad.type][0], jac_vd)
-            + der_val * derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-          non_der_val = non_der_val * derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-        }
-        else
-        {
-          non_der_val *= derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-          der_val *= derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-        }
-      }
-      else if(ad.type <= 10)
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
+  padded_active[depth_idx] = false;
+}
 
-        if(u_id == ad.u_id)
-        {
-          der_val = non_der_val *  double_derivative(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, der_type[ad.type][0], der_type[ad.type][1], jac_vd)
-            + der_val * double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd); 
-          non_der_val = non_der_val * double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-        }
-        else
-        {
-          non_der_val *=  double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-          der_val  *=  double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-        }
-      }
-      else
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
+/**
+ * @brief copy a grid into a padded grid, filling ghost layers with
+ *  periodic images
+ *
+ * @param grid grid of nx * ny * nz points
+ * @param nx number of points in x direction
+ * @param ny number of points in y direction
+ * @param nz number of points in z direction
+ * @param R width of ghost layers
+ * @param padded padded grid of (nx+2R) * (ny+2R) * (nz+2R) points
+ */
+void FASMultigrid::_fillPadded(const real_t * grid, idx_t nx, idx_t ny, idx_t nz,
+  idx_t R, real_t * padded)
+{
+  idx_t pnx = nx + 2*R, pny = ny + 2*R, pnz = nz + 2*R;
+  std::vector<idx_t> xw(pnx), yw(pny), zw(pnz);
+  for(idx_t p = 0; p < pnx; p++)
+    xw[p] = ((p - R + R*nx) % nx) * ny * nz;
+  for(idx_t p = 0; p < pny; p++)
+    yw[p] = ((p - R + R*ny) % ny) * nz;
+  for(idx_t p = 0; p < pnz; p++)
+    zw[p] = (p - R + R*nz) % nz;
 
-        if(u_id == ad.u_id)
-        {
-          der_val = non_der_val * laplacian(i, j, k, vd.nx, vd.ny, vd.nz, jac_vd)
-            + der_val * laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, vd);
-          non_der_val = non_der_val * laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, vd);
-        }
-        else
-        {
-          non_der_val *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
-          der_val *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
-        }
-      }
+  #pragma omp parallel for
+  for(idx_t pi = 0; pi < pnx; pi++)
+    for(idx_t pj = 0; pj < pny; pj++)
+    {
+      real_t * out = padded + (pi * pny + pj) * pnz;
+      const real_t * in = grid + xw[pi] + yw[pj];
+      for(idx_t pk = 0; pk < R; pk++)
+        out[pk] = in[zw[pk]];
+      for(idx_t k = 0; k < nz; k++)
+        out[R + k] = in[k];
+      for(idx_t pk = nz + R; pk < pnz; pk++)
+        out[pk] = in[zw[pk]];
     }
-    res += der_val;
-  }
-  return res;
 }
 
 /**
- * @brief      initialize a grid to 0
+ * @brief refresh padded mirrors of u (and v) and evaluate with the
+ *  padded tape until _endPaddedSweep()
+ * @details only valid while neither u nor v are written to; does nothing
+ *  if padded grids are disabled or already in use
  *
- * @param      grid    grid (array) to initialize
- * @param[in]  points  # points in array / on grid
+ * @param depth_idx index of depth
+ * @param with_v whether v is read as well
+ * @return whether padded grids were taken into use, in which case
+ *  _endPaddedSweep() must be called
  */
-void FASMultigrid::_zeroGrid(fas_grid_t & grid)
+bool FASMultigrid::_beginPaddedSweep(idx_t depth_idx, bool with_v)
 {
+  if(!padded_layout || !tapes_compiled || padded_active[depth_idx])
+    return false;
+
+  const idx_t R = STENCIL_ORDER / 2;
+  equation_tape & pt = padded_tapes[depth_idx];
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+  {
+    _fillPadded(u_h[u_id][depth_idx]._array, nx, ny, nz, R, &pt.pad_u[u_id][0]);
+    if(with_v)
+      _fillPadded(damping_v_h[u_id][depth_idx]._array, nx, ny, nz, R, &pt.pad_v[u_id][0]);
+  }
+
+  padded_active[depth_idx] = true;
+  return true;
+}
+
+/**
+ * @brief go back to evaluating with the unpadded tape
+ */
+void FASMultigrid::_endPaddedSweep(idx_t depth_idx)
+{
+  padded_active[depth_idx] = false;
+}
+
+/**
+ * @brief refresh padded mirrors of source grids at all depths
+ * @details called when tapes are compiled and whenever a solve starts,
+ *  so source grids may be changed in between solves
+ */
+void FASMultigrid::_syncPaddedSources()
+{
+  if(!padded_layout || !tapes_compiled)
+    return;
+
+  const idx_t R = STENCIL_ORDER / 2;
+  for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+  {
+    equation_tape & tape = tapes[depth_idx];
+    equation_tape & pt = padded_tapes[depth_idx];
+
+    for(idx_t m = 0; m < (idx_t) tape.mols.size(); m++)
+      if(tape.mols[m].rho != NULL)
+        _fillPadded(tape.mols[m].rho, nx_h[depth_idx], ny_h[depth_idx],
+          nz_h[depth_idx], R, &pt.pad_rho[m][0]);
+  }
+}
+
+/**
+ * @brief choose tiles for sweeps over the grids of each depth
+ * @details uses the stencil radius of the compiled tape of a depth,
+ *  or STENCIL_ORDER/2 before tapes are compiled
+ */
+void FASMultigrid::_planTilings()
+{
+  idx_t n_threads = omp_get_max_threads();
+
+  for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+  {
+    idx_t radius = tapes_compiled ? std::max(tapes[depth_idx].radius, (idx_t) 1)
+      : STENCIL_ORDER / 2;
+    // every variable, plus result and source grids
+    tilings[depth_idx] = fas_plan_tiling(nx_h[depth_idx], ny_h[depth_idx],
+      nz_h[depth_idx], radius, u_n + 2, tile_cache_bytes, n_threads);
+  }
+}
+
+/**
+ * @brief set cache size tiles of grid sweeps are chosen for
+ * @details default is 256 KiB; should be about the L2 cache of a core
+ *
+ * @param bytes cache size per thread
+ */
+void FASMultigrid::setTileCacheSize(std::size_t bytes)
+{
+  tile_cache_bytes = bytes;
+  _planTilings();
+}
+
+/**
+ * @brief use padded grids with ghost layers for sweeps that only read
+ *  u and v
+ * @details on by default; costs a mirror of u and v at every depth
+ *
+ * @param enable whether to use padded grids
+ */
+void FASMultigrid::setPaddedLayout(bool enable)
+{
+  padded_layout = enable;
+  if(tapes_compiled)
+    _compileEquationTapes();
+}
+
+/**
+ * @brief use a specialized kernel instead of the equation tape
+ *  for one equation
+ * @details kernel is not owned; pass NULL to go back to the tape
+ *
+ * @param eqn_id id of equation
+ * @param kernel kernel to use
+ */
+void FASMultigrid::setEquationKernel(idx_t eqn_id, FASEquationKernel * kernel)
+{
+  eqn_kernels[eqn_id] = kernel;
+}
+
+/**
+ * @brief C++ expression applying the stencil of an atom type to a grid
+ * @details weights are emitted for unit spacing and scaled by the
+ *  inverse spacing in the kernel context, so that one kernel serves
+ *  every depth
+ *
+ * @param type atom type (not poly)
+ * @param grid expression evaluating to the grid base pointer
+ */
+std::string FASMultigrid::_stencilSource(idx_t type, const std::string & grid)
+{
+  if(type == lap)
+    return "(" + _stencilSource(der11, grid) + " + " + _stencilSource(der22, grid)
+      + " + " + _stencilSource(der33, grid) + ")";
+
+  const real_t unit_h[4] = {0.0, 1.0, 1.0, 1.0};
+  std::vector<tape_tap> taps;
+  _appendAtomTaps(taps, type, unit_h);
+
+  std::ostringstream src;
+  src << std::setprecision(17) << "(c->inv_h[" << der_type[type][0] - 1 << "]";
+  if(type > der3)
+    src << " * c->inv_h[" << der_type[type][1] - 1 << "]";
+  src << " * (";
+  for(idx_t t = 0; t < (idx_t) taps.size(); t++)
+  {
+    src << (t > 0 ? " + " : "") << "(" << taps[t].coef << ") * " << grid
+      << "[xo[i + (" << taps[t].di << ")] + yo[j + (" << taps[t].dj
+      << ")] + zo[k + (" << taps[t].dk << ")]]";
+  }
+  src << "))";
+  return src.str();
+}
+
+/**
+ * @brief C++ expression for the centre weight of the stencil of an atom type
+ */
+std::string FASMultigrid::_stencilCenterSource(idx_t type)
+{
+  if(type == lap)
+    return "(" + _stencilCenterSource(der11) + " + " + _stencilCenterSource(der22)
+      + " + " + _stencilCenterSource(der33) + ")";
+
+  const real_t unit_h[4] = {0.0, 1.0, 1.0, 1.0};
+  std::vector<tape_tap> taps;
+  _appendAtomTaps(taps, type, unit_h);
+
+  real_t center = 0.0;
+  for(idx_t t = 0; t < (idx_t) taps.size(); t++)
+    if(taps[t].di == 0 && taps[t].dj == 0 && taps[t].dk == 0)
+      center += taps[t].coef;
+
+  std::ostringstream src;
+  src << std::setprecision(17) << "((" << center << ") * c->inv_h["
+    << der_type[type][0] - 1 << "]";
+  if(type > der3)
+    src << " * c->inv_h[" << der_type[type][1] - 1 << "]";
+  src << ")";
+  return src.str();
+}
+
+/**
+ * @brief C++ expression evaluating x^value
+ * @details integer and half-integer exponents use the fas_ipow()
+ *  multiplication chain emitted by _generateKernelSource()
+ */
+std::string FASMultigrid::_powSource(real_t value, const std::string & x)
+{
+  idx_t pow_class, pow_n;
+  _classifyExponent(value, pow_class, pow_n);
+
+  std::ostringstream src;
+  src << std::setprecision(17);
+  if(pow_class == pow_generic)
+  {
+    src << "std::pow(" << x << ", " << value << ")";
+    return src.str();
+  }
+
+  idx_t m = std::abs(pow_n);
+  if(pow_class == pow_half_integer)
+    m >>= 1;
+
+  src << "(";
+  if(pow_n < 0)
+    src << "1.0 / ";
+  src << "(fas_ipow(" << x << ", " << m << ")";
+  if(pow_class == pow_half_integer)
+    src << " * std::sqrt(" << x << ")";
+  src << "))";
+  return src.str();
+}
+
+/**
+ * @brief generate C++ source of specialized kernels for all equations
+ * @details for every equation emits fas_jit_residual_<eqn>, and for every
+ *  variable fas_jit_jac_<eqn>_<var> and fas_jit_der_<eqn>_<var>, following
+ *  the same evaluation order as the equation tape
+ */
+std::string FASMultigrid::_generateKernelSource()
+{
+  std::ostringstream src;
+  src << std::setprecision(17);
+
+  src << "// generated by FASMultigrid::_generateKernelSource()\n"
+      << "#include <cmath>\n"
+      << "typedef " << fas_type_name<real_t>::str() << " real_t;\n"
+      << "typedef " << fas_type_name<idx_t>::str() << " idx_t;\n"
+      << "typedef struct{ " FAS_XSTRINGIFY(FAS_KERNEL_CTX_FIELDS) " } fas_kernel_ctx;\n"
+      << "static inline real_t fas_ipow(real_t x, int n)\n"
+      << "{ real_t r = 1.0; for(; n > 0; n >>= 1, x *= x) if(n & 1) r *= x; return r; }\n"
+      << "#define FAS_PT const idx_t * xo = c->xo, * yo = c->yo, * zo = c->zo; "
+      << "const idx_t idx = xo[i] + yo[j] + zo[k]; (void) idx;\n";
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    // residual
+    src << "extern \"C\" real_t fas_jit_residual_" << eqn_id
+        << "(const fas_kernel_ctx * c, idx_t i, idx_t j, idx_t k)\n{\n"
+        << "  FAS_PT\n  real_t res = 0.0;\n";
+    for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+    {
+      molecule & mol = eqns[eqn_id][mol_id];
+      src << "  {\n    real_t val = " << mol.const_coef << ";\n";
+      src << "    if(c->rho[" << mol_id << "] != 0) val *= c->rho[" << mol_id << "][idx];\n";
+      for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
+      {
+        atom & ad = mol.atoms[atom_id];
+        if(ad.type == poly)
+          src << "    val *= " << _powSource(ad.value,
+            "c->u[" + std::to_string(ad.u_id) + "][idx]") << ";\n";
+      }
+      for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
+      {
+        atom & ad = mol.atoms[atom_id];
+        if(ad.type != poly)
+          src << "    val *= " << _stencilSource(ad.type,
+            "c->u[" + std::to_string(ad.u_id) + "]") << ";\n";
+      }
+      src << "    res += val;\n  }\n";
+    }
+    src << "  return res;\n}\n";
+
+    for(idx_t u_id = 0; u_id < u_n; u_id++)
+    {
+      std::string v = "c->v[" + std::to_string(u_id) + "]";
+      std::ostringstream jac, der;
+      jac << std::setprecision(17);
+      der << std::setprecision(17);
+
+      jac << "extern \"C\" void fas_jit_jac_" << eqn_id << "_" << u_id
+          << "(const fas_kernel_ctx * c, idx_t i, idx_t j, idx_t k, "
+          << "real_t * coef_a, real_t * coef_b)\n{\n"
+          << "  FAS_PT\n  real_t a = 0.0, b = 0.0;\n";
+      der << "extern \"C\" real_t fas_jit_der_" << eqn_id << "_" << u_id
+          << "(const fas_kernel_ctx * c, idx_t i, idx_t j, idx_t k)\n{\n"
+          << "  FAS_PT\n  real_t res = 0.0;\n";
+
+      for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+      {
+        molecule & mol = eqns[eqn_id][mol_id];
+
+        // terms not depending on u_id do not contribute
+        bool depends = false;
+        for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
+          depends = depends || (mol.atoms[atom_id].u_id == u_id);
+        if(!depends)
+          continue;
+
+        jac << "  {\n    real_t nd = " << mol.const_coef << ", ma = 0.0, mb = 0.0;\n";
+        der << "  {\n    real_t nd = " << mol.const_coef << ", dv = 0.0;\n";
+        jac << "    if(c->rho[" << mol_id << "] != 0) nd *= c->rho[" << mol_id << "][idx];\n";
+        der << "    if(c->rho[" << mol_id << "] != 0) nd *= c->rho[" << mol_id << "][idx];\n";
+
+        for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
+        {
+          atom & ad = mol.atoms[atom_id];
+          if(ad.type != poly)
+            continue;
+          std::string x = "c->u[" + std::to_string(ad.u_id) + "][idx]";
+          jac << "    {\n      real_t pv = " << _powSource(ad.value, x) << ";\n";
+          der << "    {\n      real_t pv = " << _powSource(ad.value, x) << ";\n";
+          if(ad.u_id == u_id)
+          {
+            jac << "      mb = mb * pv + nd * (" << ad.value << ") * "
+                << _powSource(ad.value - 1.0, x) << ";\n"
+                << "      ma *= pv;\n";
+            der << "      dv = nd * (" << ad.value << ") * "
+                << _powSource(ad.value - 1.0, x) << " * " << v << "[idx] + dv * pv;\n";
+          }
+          else
+          {
+            jac << "      ma *= pv;\n      mb *= pv;\n";
+            der << "      dv *= pv;\n";
+          }
+          jac << "      nd *= pv;\n    }\n";
+          der << "      nd *= pv;\n    }\n";
+        }
+
+        for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
+        {
+          atom & ad = mol.atoms[atom_id];
+          if(ad.type == poly)
+            continue;
+          std::string su = _stencilSource(ad.type, "c->u[" + std::to_string(ad.u_id) + "]");
+          jac << "    {\n      real_t su = " << su << ";\n";
+          der << "    {\n      real_t su = " << su << ";\n";
+          if(ad.u_id == u_id)
+          {
+            std::string sv = _stencilSource(ad.type, v);
+            std::string cc = _stencilCenterSource(ad.type);
+            jac << "      real_t sv = " << sv << ";\n"
+                << "      ma = ma * su + nd * (sv - " << cc << " * " << v << "[idx]);\n"
+                << "      mb = mb * su + nd * " << cc << ";\n";
+            der << "      real_t sv = " << sv << ";\n"
+                << "      dv = nd * sv + dv * su;\n";
+          }
+          else
+          {
+            jac << "      ma *= su;\n      mb *= su;\n";
+            der << "      dv *= su;\n";
+          }
+          jac << "      nd *= su;\n    }\n";
+          der << "      nd *= su;\n    }\n";
+        }
+
+        jac << "    a += ma;\n    b += mb;\n  }\n";
+        der << "    res += dv;\n  }\n";
+      }
+
+      jac << "  *coef_a += a;\n  *coef_b += b;\n}\n";
+      der << "  return res;\n}\n";
+      src << jac.str() << der.str();
+    }
+  }
+
+  return src.str();
+}
+
+/**
+ * @brief generate, compile and load specialized kernels for all
+ *  equations, replacing tape evaluation
+ * @details Kernels are cached on disk under a hash of the generated
+ *  source, so later runs with the same equations skip compilation.
+ *  Falls back to the equation tape if anything goes wrong. Equations
+ *  with a kernel set by setEquationKernel() keep it.
+ *
+ * @param cache_dir directory to cache compiled kernels in
+ * @return whether JIT kernels are in use
+ */
+bool FASMultigrid::enableKernelJIT(const std::string & cache_dir)
+{
+  if(!tapes_compiled)
+    _compileEquationTapes();
+
+  _disableKernelJIT();
+
+  bool needed = false;
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    needed = needed || (eqn_kernels[eqn_id] == NULL);
+  if(!needed)
+    return false;
+
+  jit = new FASKernelJIT(cache_dir);
+  if(!jit->load(_generateKernelSource()))
+  {
+    std::cout << "Falling back to interpreted equations.\n";
+    _disableKernelJIT();
+    return false;
+  }
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    // user supplied kernel
+    if(eqn_kernels[eqn_id] != NULL)
+      continue;
+
+    FASJITEquationKernel * kernel = new FASJITEquationKernel;
+    jit_kernels[eqn_id] = kernel;
+
+    kernel->residual_f = (FASJITEquationKernel::residual_fn)
+      jit->symbol("fas_jit_residual_" + std::to_string(eqn_id));
+    bool found = (kernel->residual_f != NULL);
+
+    kernel->jac_f.resize(u_n);
+    kernel->der_f.resize(u_n);
+    for(idx_t u_id = 0; u_id < u_n; u_id++)
+    {
+      std::string suffix = std::to_string(eqn_id) + "_" + std::to_string(u_id);
+      kernel->jac_f[u_id] = (FASJITEquationKernel::jac_fn)
+        jit->symbol("fas_jit_jac_" + suffix);
+      kernel->der_f[u_id] = (FASJITEquationKernel::der_fn)
+        jit->symbol("fas_jit_der_" + suffix);
+      found = found && kernel->jac_f[u_id] != NULL && kernel->der_f[u_id] != NULL;
+    }
+
+    if(!found)
+    {
+      std::cout << "Equation kernel library is incomplete; "
+                << "falling back to interpreted equations.\n";
+      _disableKernelJIT();
+      return false;
+    }
+
+    eqn_kernels[eqn_id] = kernel;
+  }
+
+  return true;
+}
+
+/**
+ * @brief drop JIT compiled kernels, going back to tape evaluation
+ */
+void FASMultigrid::_disableKernelJIT()
+{
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    if(jit_kernels[eqn_id] != NULL && eqn_kernels[eqn_id] == jit_kernels[eqn_id])
+      eqn_kernels[eqn_id] = NULL;
+    delete jit_kernels[eqn_id];
+    jit_kernels[eqn_id] = NULL;
+  }
+
+  delete jit;
+  jit = NULL;
+}
+
+/**
+ * @brief evaluate all shared powers of an equation at a point
+ *
+ * @param tape tape of depth
+ * @param eqn_id id of equation
+ * @param idx index of point
+ * @param with_der whether to also evaluate powers only needed for dF/du
+ * @param pv array of at least FAS_MAX_POW_SLOTS receiving powers,
+ *  indexed by tape_op::slot / tape_op::der_slot
+ */
+void FASMultigrid::_evaluateSharedPowers(equation_tape & tape, idx_t eqn_id,
+  idx_t idx, bool with_der, real_t * pv)
+{
+  const tape_pow * pows = &tape.pows[0] + tape.eqn_pow_begin[eqn_id];
+
+  for(idx_t g = tape.eqn_group_begin[eqn_id]; g < tape.eqn_group_begin[eqn_id+1]; g++)
+  {
+    tape_pow_group & group = tape.pow_groups[g];
+    real_t x = group.u[idx];
+
+    real_t sq[FAS_MAX_POW_BITS];
+    sq[0] = x;
+    for(idx_t b = 1; b < group.n_squares; b++)
+      sq[b] = sq[b-1] * sq[b-1];
+    real_t root = group.need_root ? std::sqrt(x) : 0.0;
+
+    for(idx_t s = group.val_begin; s < group.val_end; s++)
+      pv[s] = fas_pow_from_squares(pows[s].pow_class, pows[s].pow_n,
+        pows[s].value, x, sq, root);
+
+    if(with_der)
+      for(idx_t s = group.der_begin; s < group.der_end; s++)
+        pv[s] = fas_pow_from_squares(pows[s].pow_class, pows[s].pow_n,
+          pows[s].value, x, sq, root);
+  }
+}
+
+/**
+ * @brief apply a compiled stencil to a grid at a point
+ * @details idx is the index of (i,j,k) in the layout of the tape;
+ *  tapes of padded grids use plain linear offsets
+ */
+#define FAS_TAPE_STENCIL(result, tape, op, grid, i, j, k, idx)     \
+  {                                                                \
+    result = 0.0;                                                  \
+    if((tape).linear)                                              \
+      for(idx_t t = (op).tap_begin; t < (op).tap_end; t++)         \
+        result += (tape).taps[t].coef * (grid)[(idx) + (tape).taps[t].off]; \
+    else                                                           \
+      for(idx_t t = (op).tap_begin; t < (op).tap_end; t++)         \
+      {                                                            \
+        const tape_tap & tp = (tape).taps[t];                      \
+        result += tp.coef * (grid)[(tape).xo[(i) + tp.di]          \
+          + (tape).yo[(j) + tp.dj] + (tape).zo[(k) + tp.dk]];      \
+      }                                                            \
+  }
+
+/**
+ * @brief evaluating the value of equation at a point
+ * @param[in]  id of equation to calculate
+ * @param[in]  index of depth
+ * @param[in]  index of x direction
+ * @param[in]  index of y direction
+ * @param[in]  index of z direction
+ */
+real_t FASMultigrid::_evaluateEllipticEquationPt(idx_t eqn_id, idx_t depth_idx,
+  idx_t i, idx_t j, idx_t k)
+{
+  equation_tape & tape = _tape(depth_idx);
+
+  if(eqn_kernels[eqn_id] != NULL)
+    return eqn_kernels[eqn_id]->residual(tape.ctx[eqn_id], i, j, k);
+
+  idx_t idx = tape.xo[i] + tape.yo[j] + tape.zo[k];
+  real_t res = 0.0;
+
+  real_t pv[FAS_MAX_POW_SLOTS];
+  _evaluateSharedPowers(tape, eqn_id, idx, false, pv);
+
+  for(idx_t m = tape.eqn_mol_begin[eqn_id]; m < tape.eqn_mol_begin[eqn_id+1]; m++)
+  {
+    tape_mol & mol = tape.mols[m];
+    // value will end up being the value of a particular term in an equation
+    real_t val = mol.const_coef;
+
+    if(mol.rho != NULL)
+      val *= mol.rho[idx];
+
+    for(idx_t o = mol.poly_begin; o < mol.poly_end; o++)
+    {
+      tape_op & op = tape.ops[o];
+      val *= (op.slot >= 0) ? pv[op.slot] : fas_pow(op.pow_class, op.pow_n, op.value, op.u[idx]);
+    }
+
+    for(idx_t o = mol.sten_begin; o < mol.sten_end; o++)
+    {
+      real_t s;
+      FAS_TAPE_STENCIL(s, tape, tape.ops[o], tape.ops[o].u, i, j, k, idx);
+      val *= s;
+    }
+
+    res += val;
+  }
+  return res;
+}
+
+/**
+ * @brief evaluate value of v * \partial F(u) / \partial u, storing coefficient a and b for interation
+ * @details coefficient b is the diagonal of the Jacobian, coefficient a
+ *  the off-diagonal part of the Jacobian applied to v
+ *
+ * @param id of equation which needs to be calculated
+ * @param index of depth
+ * @param coeficient a, stores the right hand side of iteration equation
+ * @param coeficient b, stores the left hand coefficient for iteration
+ * @param x grid index
+ * @param y grid index
+ * @param z grid index
+ * @param id of variable in differentiation
+ */
+void FASMultigrid::_evaluateIterationForJacEquation(idx_t eqn_id,
+  idx_t depth_idx, real_t &coef_a, real_t &coef_b,
+  idx_t i, idx_t j, idx_t k, idx_t u_id)
+{
+  equation_tape & tape = _tape(depth_idx);
+
+  if(eqn_kernels[eqn_id] != NULL)
+  {
+    eqn_kernels[eqn_id]->iterationForJac(tape.ctx[eqn_id], i, j, k, u_id,
+      coef_a, coef_b);
+    return;
+  }
+
+  idx_t idx = tape.xo[i] + tape.yo[j] + tape.zo[k];
+
+  real_t pv[FAS_MAX_POW_SLOTS];
+  _evaluateSharedPowers(tape, eqn_id, idx, true, pv);
+
+  for(idx_t m = tape.eqn_mol_begin[eqn_id]; m < tape.eqn_mol_begin[eqn_id+1]; m++)
+  {
+    tape_mol & mol = tape.mols[m];
+    real_t mol_to_a = 0.0, mol_to_b = 0.0;
+    real_t non_der_val = mol.const_coef;
+
+    if(mol.rho != NULL)
+      non_der_val *= mol.rho[idx];
+
+    for(idx_t o = mol.poly_begin; o < mol.poly_end; o++)
+    {
+      tape_op & op = tape.ops[o];
+      real_t p = (op.slot >= 0) ? pv[op.slot] : fas_pow(op.pow_class, op.pow_n, op.value, op.u[idx]);
+      if(op.u_id == u_id)
+        mol_to_b = mol_to_b * p + non_der_val * op.value
+          * ((op.der_slot >= 0) ? pv[op.der_slot] : pow(op.u[idx], op.value - 1.0));
+      else
+        mol_to_b *= p;
+      mol_to_a *= p;
+      non_der_val *= p;
+    }
+
+    for(idx_t o = mol.sten_begin; o < mol.sten_end; o++)
+    {
+      tape_op & op = tape.ops[o];
+      real_t su;
+      FAS_TAPE_STENCIL(su, tape, op, op.u, i, j, k, idx);
+      if(op.u_id == u_id)
+      {
+        real_t sv;
+        FAS_TAPE_STENCIL(sv, tape, op, op.v, i, j, k, idx);
+        mol_to_a = mol_to_a * su + non_der_val * (sv - op.center_coef * op.v[idx]);
+        mol_to_b = mol_to_b * su + non_der_val * op.center_coef;
+      }
+      else
+      {
+        mol_to_a *= su;
+        mol_to_b *= su;
+      }
+      non_der_val *= su;
+    }
+
+    coef_a += mol_to_a;
+    coef_b += mol_to_b;
+  }
+
+  return;
+}
+
+/**
+ * @brief evaluate value of v * \partial F(u) / \partial u
+ *
+ * @param id of equation which needs to be calculated
+ * @param index of depth
+ * @param x grid index
+ * @param y grid index
+ * @param z grid index
+ * @param id of variable in differentiation
+ */    
+real_t FASMultigrid::_evaluateDerEllipticEquation(idx_t eqn_id, idx_t depth_idx, idx_t i, idx_t j, idx_t k, idx_t u_id)
+{
+  equation_tape & tape = _tape(depth_idx);
+
+  if(eqn_kernels[eqn_id] != NULL)
+    return eqn_kernels[eqn_id]->derivative(tape.ctx[eqn_id], i, j, k, u_id);
+
+  idx_t idx = tape.xo[i] + tape.yo[j] + tape.zo[k];
+  real_t res = 0.0;
+
+  real_t pv[FAS_MAX_POW_SLOTS];
+  _evaluateSharedPowers(tape, eqn_id, idx, true, pv);
+
+  for(idx_t m = tape.eqn_mol_begin[eqn_id]; m < tape.eqn_mol_begin[eqn_id+1]; m++)
+  {
+    tape_mol & mol = tape.mols[m];
+    real_t non_der_val = mol.const_coef, der_val = 0.0;
+
+    if(mol.rho != NULL)
+      non_der_val *= mol.rho[idx];
+
+    for(idx_t o = mol.poly_begin; o < mol.poly_end; o++)
+    {
+      tape_op & op = tape.ops[o];
+      real_t p = (op.slot >= 0) ? pv[op.slot] : fas_pow(op.pow_class, op.pow_n, op.value, op.u[idx]);
+      if(op.u_id == u_id)
+        der_val = non_der_val * op.value
+          * ((op.der_slot >= 0) ? pv[op.der_slot] : pow(op.u[idx], op.value - 1.0)) * op.v[idx]
+          + der_val * p;
+      else
+        der_val *= p;
+      non_der_val *= p;
+    }
+
+    for(idx_t o = mol.sten_begin; o < mol.sten_end; o++)
+    {
+      tape_op & op = tape.ops[o];
+      real_t su;
+      FAS_TAPE_STENCIL(su, tape, op, op.u, i, j, k, idx);
+      if(op.u_id == u_id)
+      {
+        real_t sv;
+        FAS_TAPE_STENCIL(sv, tape, op, op.v, i, j, k, idx);
+        der_val = non_der_val * sv + der_val * su;
+      }
+      else
+        der_val *= su;
+      non_der_val *= su;
+    }
+
+    res += der_val;
+  }
+  return res;
+}
+
+/**
+ * @brief set memory available for storing Jacobians
+ * @details Jacobians are stored for as many depths as fit, finest depth
+ *  first; other depths apply the Jacobian matrix-free. A budget of 0
+ *  (the default) keeps every depth matrix-free.
+ *
+ * @param bytes memory budget
+ */
+void FASMultigrid::setLinearizationMemoryBudget(std::size_t bytes)
+{
+  linearization_budget = bytes;
+  if(tapes_compiled)
+    _planLinearizationStorage();
+}
+
+/**
+ * @brief release stored Jacobians at all depths
+ */
+void FASMultigrid::_freeLinearizationStorage()
+{
+  for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+  {
+    frozen_linearization & lin = linearizations[depth_idx];
+    for(idx_t t = 0; t < (idx_t) lin.terms.size(); t++)
+      delete [] lin.terms[t].coef;
+    for(idx_t eqn_id = 0; eqn_id < (idx_t) lin.diag.size(); eqn_id++)
+      delete [] lin.diag[eqn_id];
+    lin.terms.clear();
+    lin.eqn_term_begin.clear();
+    lin.op_term.clear();
+    lin.diag.clear();
+    lin.stored = false;
+  }
+}
+
+/**
+ * @brief decide at which depths Jacobians are stored and allocate them
+ * @details atoms of the same type acting on the same variable share a
+ *  term, so each equation needs one coefficient grid per distinct
+ *  (variable, atom type) pair plus its diagonal
+ */
+void FASMultigrid::_planLinearizationStorage()
+{
+  _freeLinearizationStorage();
+  linearization_lines = (relax_scheme == line_relaxation);
+
+  std::size_t used = 0;
+  for(idx_t depth_idx = max_depth_idx; depth_idx >= min_depth_idx; --depth_idx)
+  {
+    equation_tape & tape = tapes[depth_idx];
+    frozen_linearization & lin = linearizations[depth_idx];
+    idx_t pts = nx_h[depth_idx] * ny_h[depth_idx] * nz_h[depth_idx];
+    bool fits_ops = true;
+
+    lin.eqn_term_begin.assign(u_n + 1, 0);
+    lin.op_term.assign(tape.ops.size(), -1);
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    {
+      lin.eqn_term_begin[eqn_id] = lin.terms.size();
+      for(idx_t m = tape.eqn_mol_begin[eqn_id]; m < tape.eqn_mol_begin[eqn_id+1]; m++)
+      {
+        if(tape.mols[m].sten_end - tape.mols[m].poly_begin > FAS_MAX_MOL_OPS)
+          fits_ops = false;
+
+        for(idx_t o = tape.mols[m].poly_begin; o < tape.mols[m].sten_end; o++)
+        {
+          tape_op & op = tape.ops[o];
+          idx_t t = lin.eqn_term_begin[eqn_id];
+          while(t < (idx_t) lin.terms.size()
+              && (lin.terms[t].u_id != op.u_id || lin.terms[t].type != op.type))
+            t++;
+          if(t == (idx_t) lin.terms.size())
+          {
+            frozen_term ft;
+            ft.u_id = op.u_id;
+            ft.type = op.type;
+            ft.op = (op.type == poly) ? -1 : o;
+            ft.center_coef = op.center_coef;
+            ft.v = op.v;
+            ft.coef = NULL;
+            lin.terms.push_back(ft);
+          }
+          lin.op_term[o] = t;
+        }
+      }
+    }
+    lin.eqn_term_begin[u_n] = lin.terms.size();
+
+    // line relaxation needs stored Jacobians regardless of budget
+    std::size_t bytes = (lin.terms.size() + u_n) * pts * sizeof(real_t);
+    if(!fits_ops || (relax_scheme != line_relaxation && used + bytes > linearization_budget))
+    {
+      lin.terms.clear();
+      lin.eqn_term_begin.clear();
+      lin.op_term.clear();
+      continue;
+    }
+
+    used += bytes;
+    for(idx_t t = 0; t < (idx_t) lin.terms.size(); t++)
+      lin.terms[t].coef = new real_t[pts];
+    lin.diag.resize(u_n);
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      lin.diag[eqn_id] = new real_t[pts];
+    lin.stored = true;
+  }
+}
+
+/**
+ * @brief store the Jacobian of all equations at the current u
+ * @details coefficient of each atom is the product of all other atoms
+ *  of its term, formed from prefix and suffix products
+ *
+ * @param depth_idx index of depth
+ * @return whether Jacobian is stored; false if the Jacobian has to be
+ *  applied matrix-free (no storage at this depth, or a user supplied
+ *  equation kernel that the tape may not describe)
+ */
+bool FASMultigrid::_freezeLinearization(idx_t depth_idx)
+{
+  frozen_linearization & lin = linearizations[depth_idx];
+  if(!lin.stored)
+    return false;
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    if(eqn_kernels[eqn_id] != NULL && eqn_kernels[eqn_id] != jit_kernels[eqn_id])
+      return false;
+
+  equation_tape & tape = tapes[depth_idx];
+  idx_t i, j, k;
+
+  #pragma omp parallel for default(shared) private(i,j,k)
+  FAS_TILED_LOOP3(i, j, k, tilings[depth_idx])
+  {
+    idx_t idx = tape.xo[i] + tape.yo[j] + tape.zo[k];
+
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    {
+      for(idx_t t = lin.eqn_term_begin[eqn_id]; t < lin.eqn_term_begin[eqn_id+1]; t++)
+        lin.terms[t].coef[idx] = 0.0;
+
+      real_t pv[FAS_MAX_POW_SLOTS];
+      _evaluateSharedPowers(tape, eqn_id, idx, true, pv);
+
+      for(idx_t m = tape.eqn_mol_begin[eqn_id]; m < tape.eqn_mol_begin[eqn_id+1]; m++)
+      {
+        tape_mol & mol = tape.mols[m];
+        // value and derivative of each atom, product of preceding atoms
+        real_t f[FAS_MAX_MOL_OPS], d[FAS_MAX_MOL_OPS], pre[FAS_MAX_MOL_OPS];
+        idx_t n = 0;
+
+        for(idx_t o = mol.poly_begin; o < mol.poly_end; o++, n++)
+        {
+          tape_op & op = tape.ops[o];
+          f[n] = (op.slot >= 0) ? pv[op.slot] : fas_pow(op.pow_class, op.pow_n, op.value, op.u[idx]);
+          d[n] = op.value
+            * ((op.der_slot >= 0) ? pv[op.der_slot] : pow(op.u[idx], op.value - 1.0));
+        }
+        for(idx_t o = mol.sten_begin; o < mol.sten_end; o++, n++)
+        {
+          FAS_TAPE_STENCIL(f[n], tape, tape.ops[o], tape.ops[o].u, i, j, k, idx);
+          d[n] = 1.0;
+        }
+
+        real_t prod = mol.const_coef;
+        if(mol.rho != NULL)
+          prod *= mol.rho[idx];
+        for(idx_t a = 0; a < n; a++)
+        {
+          pre[a] = prod;
+          prod *= f[a];
+        }
+
+        real_t suf = 1.0;
+        for(idx_t a = n - 1; a >= 0; a--)
+        {
+          lin.terms[lin.op_term[mol.poly_begin + a]].coef[idx] += pre[a] * suf * d[a];
+          suf *= f[a];
+        }
+      }
+
+      real_t diag = 0.0;
+      for(idx_t t = lin.eqn_term_begin[eqn_id]; t < lin.eqn_term_begin[eqn_id+1]; t++)
+        if(lin.terms[t].u_id == eqn_id)
+          diag += lin.terms[t].center_coef * lin.terms[t].coef[idx];
+      lin.diag[eqn_id][idx] = diag;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief evaluate \sum_u \partial F(u) / \partial u * v from the stored Jacobian
+ *
+ * @param id of equation which needs to be calculated
+ * @param index of depth
+ * @param x grid index
+ * @param y grid index
+ * @param z grid index
+ */
+real_t FASMultigrid::_evaluateFrozenDerEquation(idx_t eqn_id, idx_t depth_idx,
+  idx_t i, idx_t j, idx_t k)
+{
+  equation_tape & tape = tapes[depth_idx];
+  frozen_linearization & lin = linearizations[depth_idx];
+
+  idx_t idx = tape.xo[i] + tape.yo[j] + tape.zo[k];
+  real_t res = 0.0;
+
+  for(idx_t t = lin.eqn_term_begin[eqn_id]; t < lin.eqn_term_begin[eqn_id+1]; t++)
+  {
+    frozen_term & ft = lin.terms[t];
+    real_t s;
+    if(ft.op < 0)
+      s = ft.v[idx];
+    else
+      FAS_TAPE_STENCIL(s, tape, tape.ops[ft.op], ft.v, i, j, k, idx);
+    res += ft.coef[idx] * s;
+  }
+  return res;
+}
+
+/**
+ * @brief      initialize a grid to 0
+ *
+ * @param      grid    grid (array) to initialize
+ * @param[in]  points  # points in array / on grid
+ */
+void FASMultigrid::_zeroGrid(fas_grid_t & grid)
+{
+  #pragma omp parallel for
   for(idx_t i = 0; i < grid.pts; i++)
     grid[i] = 0;
 }
 
 /**
- * @brief Shift all values in grid by a value
- * @details eg; grid[i] += shift for all i
- * 
- * @param grid grid to shift
- * @param shift amount to shift by
- * @param points # points in grid
+ * @brief Shift all values in grid by a value
+ * @details eg; grid[i] += shift for all i
+ * 
+ * @param grid grid to shift
+ * @param shift amount to shift by
+ * @param points # points in grid
+ */
+void FASMultigrid::_shiftGridVals(fas_grid_t & grid, real_t shift)
+{
+  #pragma omp parallel for
+  for(idx_t i = 0; i < grid.pts; i++)
+    grid[i] += shift;
+}
+
+/**
+ * @brief "restrict" a fine grid to coarser grid, using the restriction
+ *  operator configured for the fine depth (see cycle_cfg)
+ * 
+ * @param field_heirarchy field to restrict
+ * @param fine_depth "depth" of finer grid
+ */
+void FASMultigrid::_restrictFine2coarse(fas_heirarchy_t grid_heirarchy, idx_t fine_depth)
+{
+  (this->*restriction_ops[cycle_cfg.restriction[_dIdx(fine_depth)]])(grid_heirarchy, fine_depth);
+}
+
+/**
+ * @brief interpolate a coarse grid to a finer grid, using the
+ *  prolongation operator configured for the fine depth (see cycle_cfg)
+ *
+ * @param grid_heirarchy field to interpolate
+ * @param coarse_depth "depth" of coarser grid
+ */
+void FASMultigrid::_interpolateCoarse2fine(fas_heirarchy_t grid_heirarchy, idx_t coarse_depth)
+{
+  (this->*prolongation_ops[cycle_cfg.prolongation[_dIdx(coarse_depth + 1)]])(grid_heirarchy,
+    coarse_depth);
+}
+
+/**
+ * @brief restrict by injection: coarse points take the value of the
+ *  fine point they coincide with
+ *
+ * @param field_heirarchy field to restrict
+ * @param fine_depth "depth" of finer grid
+ */
+void FASMultigrid::_restrictInjection(fas_heirarchy_t grid_heirarchy, idx_t fine_depth)
+{
+  idx_t fine_idx = _dIdx(fine_depth);
+  idx_t coarse_idx = fine_idx - 1;
+
+  idx_t n_fine_y = ny_h[fine_idx], n_fine_z = nz_h[fine_idx];
+  idx_t n_coarse_x = nx_h[coarse_idx], n_coarse_y = ny_h[coarse_idx],
+        n_coarse_z = nz_h[coarse_idx];
+  idx_t rx = rx_h[fine_idx], ry = ry_h[fine_idx], rz = rz_h[fine_idx];
+
+  const real_t * fine = grid_heirarchy[fine_idx]._array;
+  real_t * coarse = grid_heirarchy[coarse_idx]._array;
+
+  #pragma omp parallel for
+  for(idx_t r = 0; r < n_coarse_x * n_coarse_y; r++)
+  {
+    idx_t ci = r / n_coarse_y, cj = r % n_coarse_y;
+    const real_t * f = fine + (rx*ci*n_fine_y + ry*cj)*n_fine_z;
+    real_t * out = coarse + r*n_coarse_z;
+    for(idx_t ck = 0; ck < n_coarse_z; ck++)
+      out[ck] = f[rz*ck];
+  }
+}
+
+/**
+ * @brief restrict with 7-point half weighting:
+ *  (1 given cell)*(1/2) + (6 adjacent "faces") * (1/12)
+ * @details only faces along coarsened axes are used, sharing the
+ *  weight 1/2 between them
+ *
+ * @param field_heirarchy field to restrict
+ * @param fine_depth "depth" of finer grid
+ */
+void FASMultigrid::_restrictHalfWeighting(fas_heirarchy_t grid_heirarchy, idx_t fine_depth)
+{
+  idx_t fine_idx = _dIdx(fine_depth);
+  idx_t coarse_idx = fine_idx - 1;
+
+  idx_t n_fine_x = nx_h[fine_idx], n_fine_y = ny_h[fine_idx], n_fine_z = nz_h[fine_idx];
+  idx_t n_coarse_x = nx_h[coarse_idx], n_coarse_y = ny_h[coarse_idx],
+        n_coarse_z = nz_h[coarse_idx];
+  idx_t rx = rx_h[fine_idx], ry = ry_h[fine_idx], rz = rz_h[fine_idx];
+
+  // weights of faces along each axis, zero if axis is not coarsened
+  idx_t n_coarsened = (rx == 2) + (ry == 2) + (rz == 2);
+  real_t w_face = 0.5 / (2 * n_coarsened);
+  real_t wx = (rx == 2) ? w_face : 0.0, wy = (ry == 2) ? w_face : 0.0,
+         wz = (rz == 2) ? w_face : 0.0;
+
+  const real_t * fine = grid_heirarchy[fine_idx]._array;
+  real_t * coarse = grid_heirarchy[coarse_idx]._array;
+
+  #pragma omp parallel for
+  for(idx_t r = 0; r < n_coarse_x * n_coarse_y; r++)
+  {
+    idx_t ci = r / n_coarse_y, cj = r % n_coarse_y;
+    idx_t fi = rx*ci, fj = ry*cj;
+    idx_t fi_m = (fi - 1 + n_fine_x) % n_fine_x, fi_p = (fi + 1) % n_fine_x;
+    idx_t fj_m = (fj - 1 + n_fine_y) % n_fine_y, fj_p = (fj + 1) % n_fine_y;
+
+    const real_t * f_0 = fine + (fi*n_fine_y + fj)*n_fine_z;
+    const real_t * f_xm = fine + (fi_m*n_fine_y + fj)*n_fine_z;
+    const real_t * f_xp = fine + (fi_p*n_fine_y + fj)*n_fine_z;
+    const real_t * f_ym = fine + (fi*n_fine_y + fj_m)*n_fine_z;
+    const real_t * f_yp = fine + (fi*n_fine_y + fj_p)*n_fine_z;
+    real_t * out = coarse + r*n_coarse_z;
+
+    for(idx_t ck = 0; ck < n_coarse_z; ck++)
+    {
+      idx_t fk = rz*ck;
+      idx_t fk_m = (fk - 1 + n_fine_z) % n_fine_z, fk_p = (fk + 1) % n_fine_z;
+      out[ck] = 0.5 * f_0[fk] + wx * (f_xm[fk] + f_xp[fk])
+        + wy * (f_ym[fk] + f_yp[fk]) + wz * (f_0[fk_m] + f_0[fk_p]);
+    }
+  }
+}
+
+/**
+ * @brief restrict with 27-point full weighting
+ * @details Restriction scheme:
+ *  (1 given cell)*(1/8) + (6 adjacent "faces") * (1/16)
+ *  + (12 adjacent "edges") * (1/32) + (8 adjacent "corners") * (1/64),
+ *  applied as the tensor product of [1/4, 1/2, 1/4] in each coarsened
+ *  direction (and [1] in the others): for every coarse row in z, the
+ *  fine rows around it are combined in y, then in x, and the resulting
+ *  fine row is reduced in z. All passes run along contiguous rows.
+ * 
+ * @param field_heirarchy field to restrict
+ * @param fine_depth "depth" of finer grid
+ */
+void FASMultigrid::_restrictFullWeighting(fas_heirarchy_t grid_heirarchy, idx_t fine_depth)
+{
+  idx_t fine_idx = _dIdx(fine_depth);
+  idx_t coarse_idx = fine_idx - 1;
+
+  idx_t n_fine_x = nx_h[fine_idx], n_fine_y = ny_h[fine_idx], n_fine_z = nz_h[fine_idx];
+  idx_t n_coarse_x = nx_h[coarse_idx], n_coarse_y = ny_h[coarse_idx],
+        n_coarse_z = nz_h[coarse_idx];
+  idx_t rx = rx_h[fine_idx], ry = ry_h[fine_idx], rz = rz_h[fine_idx];
+
+  const real_t * fine = grid_heirarchy[fine_idx]._array;
+  real_t * coarse = grid_heirarchy[coarse_idx]._array;
+
+  #pragma omp parallel default(shared)
+  {
+    // fine rows combined in y for each of the (up to) three planes in x
+    std::vector<real_t> yrows(3 * n_fine_z);
+    // fine row combined in x and y, preceded by periodic image of its last point
+    std::vector<real_t> xrow(n_fine_z + 1);
+
+    #pragma omp for
+    for(idx_t r = 0; r < n_coarse_x * n_coarse_y; r++)
+    {
+      idx_t ci = r / n_coarse_y, cj = r % n_coarse_y;
+      idx_t fj = ry*cj;
+      idx_t fj_m = (fj - 1 + n_fine_y) % n_fine_y, fj_p = (fj + 1) % n_fine_y;
+      const real_t * y[3];
+
+      for(idx_t a = 0; a < 3; a++)
+      {
+        if(rx == 1 && a != 1)
+          continue;
+        idx_t fi = (rx*ci + a - 1 + n_fine_x) % n_fine_x;
+        const real_t * f_0 = fine + (fi*n_fine_y + fj)*n_fine_z;
+        if(ry == 1)
+        {
+          y[a] = f_0;
+          continue;
+        }
+        const real_t * f_m = fine + (fi*n_fine_y + fj_m)*n_fine_z;
+        const real_t * f_p = fine + (fi*n_fine_y + fj_p)*n_fine_z;
+        real_t * y_a = &yrows[a*n_fine_z];
+        for(idx_t fk = 0; fk < n_fine_z; fk++)
+          y_a[fk] = 0.25 * (f_m[fk] + f_p[fk]) + 0.5 * f_0[fk];
+        y[a] = y_a;
+      }
+
+      real_t * x = &xrow[1];
+      if(rx == 2)
+        for(idx_t fk = 0; fk < n_fine_z; fk++)
+          x[fk] = 0.25 * (y[0][fk] + y[2][fk]) + 0.5 * y[1][fk];
+      else
+        for(idx_t fk = 0; fk < n_fine_z; fk++)
+          x[fk] = y[1][fk];
+      x[-1] = x[n_fine_z - 1];
+
+      real_t * out = coarse + r*n_coarse_z;
+      if(rz == 2)
+        for(idx_t ck = 0; ck < n_coarse_z; ck++)
+          out[ck] = 0.25 * (x[2*ck - 1] + x[2*ck + 1]) + 0.5 * x[2*ck];
+      else
+        for(idx_t ck = 0; ck < n_coarse_z; ck++)
+          out[ck] = x[ck];
+    }
+  }
+}
+
+/**
+ * @brief interpolate a coarse grid to a finer grid trilinearly
+ * @details Trilinear interpolation as a gather: along each coarsened
+ *  axis an even fine point has one coarse parent (weight 1) and an odd
+ *  one two (weight 1/2 each); along other axes the parent is the
+ *  coinciding point. Each fine row in z is computed from a row of
+ *  coarse values already combined in x and y (see
+ *  _prolongRowTrilinear()), so every fine value is written exactly
+ *  once, without atomics and independently of the number of threads.
+ *
+ * @param grid_heirarchy field to interpolate
+ * @param coarse_depth "depth" of coarser grid
+ */
+void FASMultigrid::_prolongTrilinear(fas_heirarchy_t grid_heirarchy, idx_t coarse_depth)
+{
+  idx_t fine_idx = _dIdx(coarse_depth +1);
+  idx_t coarse_idx = _dIdx(coarse_depth);
+  idx_t n_fine_x = nx_h[fine_idx], n_fine_y = ny_h[fine_idx], n_fine_z = nz_h[fine_idx];
+
+  const real_t * coarse = grid_heirarchy[coarse_idx]._array;
+  real_t * fine = grid_heirarchy[fine_idx]._array;
+
+  #pragma omp parallel default(shared)
+  {
+    std::vector<real_t> row;
+
+    #pragma omp for
+    for(idx_t r = 0; r < n_fine_x * n_fine_y; r++)
+      _prolongRowTrilinear(fine_idx, coarse, NULL, r, row, fine + r*n_fine_z, false);
+  }
+}
+
+/**
+ * @brief interpolate a coarse grid to a finer grid tricubically
+ * @details Along each coarsened axis an even fine point takes the value
+ *  of its coarse parent, an odd one the cubic interpolant of the four
+ *  nearest coarse points, weights (-1/16, 9/16, 9/16, -1/16). Gather
+ *  structured like _prolongTrilinear().
+ *
+ * @param grid_heirarchy field to interpolate
+ * @param coarse_depth "depth" of coarser grid
+ */
+void FASMultigrid::_prolongTricubic(fas_heirarchy_t grid_heirarchy, idx_t coarse_depth)
+{
+  idx_t fine_idx = _dIdx(coarse_depth +1);
+  idx_t coarse_idx = _dIdx(coarse_depth);
+  idx_t n_fine_x = nx_h[fine_idx], n_fine_y = ny_h[fine_idx], n_fine_z = nz_h[fine_idx];
+
+  const real_t * coarse = grid_heirarchy[coarse_idx]._array;
+  real_t * fine = grid_heirarchy[fine_idx]._array;
+
+  #pragma omp parallel default(shared)
+  {
+    std::vector<real_t> row;
+
+    #pragma omp for
+    for(idx_t r = 0; r < n_fine_x * n_fine_y; r++)
+      _prolongRowTricubic(fine_idx, coarse, NULL, r, row, fine + r*n_fine_z, false);
+  }
+}
+
+/**
+ * @brief trilinear interpolation of a single fine row in z
+ *
+ * @param fine_idx index of fine depth
+ * @param coarse coarse grid
+ * @param coarse_sub grid subtracted from coarse before interpolating, or NULL
+ * @param r index of fine row, fi * ny + fj
+ * @param row scratch space
+ * @param out fine row
+ * @param add whether to add the interpolated row to out rather than store it
+ */
+void FASMultigrid::_prolongRowTrilinear(idx_t fine_idx, const real_t * coarse,
+  const real_t * coarse_sub, idx_t r, std::vector<real_t> & row, real_t * out, bool add)
+{
+  idx_t coarse_idx = fine_idx - 1;
+  idx_t n_coarse_x = nx_h[coarse_idx], n_coarse_y = ny_h[coarse_idx],
+    n_coarse_z = nz_h[coarse_idx];
+  idx_t n_fine_y = ny_h[fine_idx];
+  idx_t rx = rx_h[fine_idx], ry = ry_h[fine_idx], rz = rz_h[fine_idx];
+
+  // coarse row combined in x and y, with periodic image of first point
+  row.resize(n_coarse_z + 1);
+
+  idx_t fi = r / n_fine_y, fj = r % n_fine_y;
+  bool odd_i = fi % rx, odd_j = fj % ry;
+  idx_t ci0 = fi / rx, ci1 = (ci0 + odd_i) % n_coarse_x;
+  idx_t cj0 = fj / ry, cj1 = (cj0 + odd_j) % n_coarse_y;
+
+  idx_t o00 = (ci0*n_coarse_y + cj0)*n_coarse_z, o01 = (ci0*n_coarse_y + cj1)*n_coarse_z,
+    o10 = (ci1*n_coarse_y + cj0)*n_coarse_z, o11 = (ci1*n_coarse_y + cj1)*n_coarse_z;
+  auto c = [&](idx_t o) {
+    return (coarse_sub != NULL) ? coarse[o] - coarse_sub[o] : coarse[o];
+  };
+
+  if(!odd_i && !odd_j)
+    for(idx_t ck = 0; ck < n_coarse_z; ck++)
+      row[ck] = c(o00 + ck);
+  else if(!odd_i)
+    for(idx_t ck = 0; ck < n_coarse_z; ck++)
+      row[ck] = 0.5 * (c(o00 + ck) + c(o01 + ck));
+  else if(!odd_j)
+    for(idx_t ck = 0; ck < n_coarse_z; ck++)
+      row[ck] = 0.5 * (c(o00 + ck) + c(o10 + ck));
+  else
+    for(idx_t ck = 0; ck < n_coarse_z; ck++)
+      row[ck] = 0.25 * ((c(o00 + ck) + c(o01 + ck)) + (c(o10 + ck) + c(o11 + ck)));
+  row[n_coarse_z] = row[0];
+
+  if(rz == 2)
+    for(idx_t ck = 0; ck < n_coarse_z; ck++)
+    {
+      real_t even = row[ck], odd = 0.5 * (row[ck] + row[ck + 1]);
+      out[2*ck] = add ? out[2*ck] + even : even;
+      out[2*ck + 1] = add ? out[2*ck + 1] + odd : odd;
+    }
+  else
+    for(idx_t ck = 0; ck < n_coarse_z; ck++)
+      out[ck] = add ? out[ck] + row[ck] : row[ck];
+}
+
+/**
+ * @brief tricubic interpolation of a single fine row in z
+ * @details parameters as for _prolongRowTrilinear()
+ */
+void FASMultigrid::_prolongRowTricubic(idx_t fine_idx, const real_t * coarse,
+  const real_t * coarse_sub, idx_t r, std::vector<real_t> & row_buf, real_t * out, bool add)
+{
+  idx_t coarse_idx = fine_idx - 1;
+  idx_t n_coarse_x = nx_h[coarse_idx], n_coarse_y = ny_h[coarse_idx],
+    n_coarse_z = nz_h[coarse_idx];
+  idx_t n_fine_y = ny_h[fine_idx];
+  idx_t rx = rx_h[fine_idx], ry = ry_h[fine_idx], rz = rz_h[fine_idx];
+
+  const real_t w_cubic[4] = { -1.0/16.0, 9.0/16.0, 9.0/16.0, -1.0/16.0 };
+  const real_t w_inject[1] = { 1.0 };
+
+  // coarse row combined in x and y, with periodic images of one point
+  // before and two points after
+  row_buf.resize(n_coarse_z + 3);
+  real_t * row = &row_buf[1];
+
+  idx_t fi = r / n_fine_y, fj = r % n_fine_y;
+  bool odd_i = fi % rx, odd_j = fj % ry;
+
+  // coarse parents and weights along x and y
+  idx_t nwx = odd_i ? 4 : 1, nwy = odd_j ? 4 : 1;
+  const real_t * wx = odd_i ? w_cubic : w_inject;
+  const real_t * wy = odd_j ? w_cubic : w_inject;
+  idx_t ci_first = odd_i ? fi / rx - 1 : fi / rx;
+  idx_t cj_first = odd_j ? fj / ry - 1 : fj / ry;
+
+  for(idx_t ck = 0; ck < n_coarse_z; ck++)
+    row[ck] = 0.0;
+  for(idx_t a = 0; a < nwx; a++)
+  {
+    idx_t ci = (ci_first + a + n_coarse_x) % n_coarse_x;
+    for(idx_t b = 0; b < nwy; b++)
+    {
+      idx_t cj = (cj_first + b + n_coarse_y) % n_coarse_y;
+      idx_t o = (ci*n_coarse_y + cj)*n_coarse_z;
+      real_t w = wx[a] * wy[b];
+      if(coarse_sub != NULL)
+        for(idx_t ck = 0; ck < n_coarse_z; ck++)
+          row[ck] += w * (coarse[o + ck] - coarse_sub[o + ck]);
+      else
+        for(idx_t ck = 0; ck < n_coarse_z; ck++)
+          row[ck] += w * coarse[o + ck];
+    }
+  }
+
+  if(rz == 2)
+  {
+    row[-1] = row[n_coarse_z - 1];
+    row[n_coarse_z] = row[0];
+    row[n_coarse_z + 1] = row[1 % n_coarse_z];
+    for(idx_t ck = 0; ck < n_coarse_z; ck++)
+    {
+      real_t even = row[ck], odd = w_cubic[0] * row[ck - 1] + w_cubic[1] * row[ck]
+        + w_cubic[2] * row[ck + 1] + w_cubic[3] * row[ck + 2];
+      out[2*ck] = add ? out[2*ck] + even : even;
+      out[2*ck + 1] = add ? out[2*ck + 1] + odd : odd;
+    }
+  }
+  else
+    for(idx_t ck = 0; ck < n_coarse_z; ck++)
+      out[ck] = add ? out[ck] + row[ck] : row[ck];
+}
+
+/**
+ * @brief restriction operators, indexed by restriction_t
+ */
+const FASMultigrid::transfer_fn FASMultigrid::restriction_ops[] = {
+  &FASMultigrid::_restrictInjection,
+  &FASMultigrid::_restrictHalfWeighting,
+  &FASMultigrid::_restrictFullWeighting
+};
+
+/**
+ * @brief prolongation operators, indexed by prolongation_t
+ */
+const FASMultigrid::transfer_fn FASMultigrid::prolongation_ops[] = {
+  &FASMultigrid::_prolongTrilinear,
+  &FASMultigrid::_prolongTricubic
+};
+
+/**
+ * @brief single row prolongation operators, indexed by prolongation_t
+ */
+const FASMultigrid::prolong_row_fn FASMultigrid::prolongation_row_ops[] = {
+  &FASMultigrid::_prolongRowTrilinear,
+  &FASMultigrid::_prolongRowTricubic
+};
+
+/**
+ * @brief      Evaluate elliptic equation, stores in an array
+ * 
+ * @param      result_h  grid to store result on
+ * @param      eqn_id    id of equation to deal with
+ * @param[in]  depth     depth to evaluate at
+ */
+void FASMultigrid::_evaluateEllipticEquation(fas_heirarchy_t result_h, idx_t eqn_id, idx_t depth)
+{
+  idx_t i, j, k;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+
+  fas_grid_t & result = result_h[depth_idx];
+
+  bool padded = _beginPaddedSweep(depth_idx, false);
+
+  if(eqn_kernels[eqn_id] != NULL)
+    eqn_kernels[eqn_id]->evaluate(_tape(depth_idx).ctx[eqn_id], tilings[depth_idx],
+      result._array);
+  else
+  {
+    #pragma omp parallel for default(shared) private(i,j,k)
+    FAS_TILED_LOOP3(i, j, k, tilings[depth_idx])
+    {
+      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      result[idx] = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k); 
+    }
+  }
+
+  if(padded)
+    _endPaddedSweep(depth_idx);
+}
+
+  
+/**
+ * @brief      Computes residual, stores result in "tmp" heirarchy
+ * @param      residual_h  grid to store result on
+ * @param      eqn_id    id of equation to deal with
+ * @param[in]  depth     depth to evaluate at
+ */
+void FASMultigrid::_computeResidual(fas_heirarchy_t residual_h, idx_t eqn_id, idx_t depth)
+{
+  idx_t i, j, k;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = residual_h[depth_idx].nx, ny = residual_h[depth_idx].ny, nz = residual_h[depth_idx].nz;
+
+  fas_grid_t & coarse_src = coarse_src_h[eqn_id][depth_idx];
+  fas_grid_t & residual = residual_h[depth_idx];
+
+  _evaluateEllipticEquation(residual_h, eqn_id, depth);
+
+  #pragma omp parallel for default(shared) private(i,j,k)
+  FAS_TILED_LOOP3(i, j, k, tilings[depth_idx])
+  {
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+    residual[idx] = coarse_src[idx] - residual[idx];
+  }
+}
+
+/**
+ * @brief      Computes max residual for a equation
+ * @param      eqn_id id of equation we deal with
+ * @param[in]  depth  depth to compute residual at
+ * @return residual
+ */
+real_t FASMultigrid::_getMaxResidual(idx_t eqn_id, idx_t depth)
+{
+  idx_t depth_idx = _dIdx(depth);
+  fas_grid_t & coarse_src = coarse_src_h[eqn_id][depth_idx];
+
+  return fas_reduce_residual(tilings[depth_idx],
+    [&](idx_t i, idx_t j, idx_t k, idx_t idx) {
+      return coarse_src[idx] - _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k);
+    }).max_abs;
+}
+
+/**
+ * @brief max. residual and |F(u) - coarse_src|^2 of all equations,
+ *  storing -(F(u) - coarse_src) in jac_rhs
+ * @details a single evaluation of the equations per point provides the
+ *  stopping test of relaxation, the norm used by the line search and the
+ *  right hand side of the Jacobian equation
+ *
+ * @param depth_idx index of depth
+ * @return norms
+ */
+fas_residual_norms FASMultigrid::_evaluateRelaxResidual(idx_t depth_idx)
+{
+  bool padded = _beginPaddedSweep(depth_idx, false);
+  fas_residual_norms norms = fas_reduce_residuals(u_n, tilings[depth_idx],
+    [&](idx_t eqn_id, idx_t i, idx_t j, idx_t k, idx_t idx) {
+      real_t temp = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k)
+        - coarse_src_h[eqn_id][depth_idx][idx];
+      jac_rhs_h[eqn_id][depth_idx][idx] = -temp;
+      return temp;
+    });
+  if(padded)
+    _endPaddedSweep(depth_idx);
+
+  return norms;
+}
+
+/**
+ * @brief get maximum residual among all equations
+ *
+ * @param depth to perform calculation
+ * @return residual 
+ */  
+real_t FASMultigrid::_getMaxResidualAllEqs(idx_t depth)
+{
+  idx_t depth_idx = _dIdx(depth);
+  bool padded = _beginPaddedSweep(depth_idx, false);
+  real_t max_for_all = fas_reduce_residuals(u_n, tilings[depth_idx],
+    [&](idx_t eqn_id, idx_t i, idx_t j, idx_t k, idx_t idx) {
+      return coarse_src_h[eqn_id][depth_idx][idx]
+        - _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k);
+    }).max_abs;
+  if(padded)
+    _endPaddedSweep(depth_idx);
+  return max_for_all;
+}
+
+
+/**
+ * @brief restriction of a fine grid to a single coarse point
+ * @details same weights, and the same order of operations, as
+ *  _restrictInjection(), _restrictHalfWeighting() and
+ *  _restrictFullWeighting()
+ *
+ * @param op restriction operator
+ * @param f fine value coinciding with the coarse point
+ * @param sx stride of f in x direction
+ * @param sy stride of f in y direction
+ * @param rx coarsening ratio in x direction (1 or 2)
+ * @param ry coarsening ratio in y direction
+ * @param rz coarsening ratio in z direction
+ * @return restricted value
+ */
+static inline real_t fas_restrict_point(FASMultigrid::restriction_t op, const real_t * f,
+  idx_t sx, idx_t sy, idx_t rx, idx_t ry, idx_t rz)
+{
+  if(op == FASMultigrid::restrict_injection)
+    return f[0];
+
+  if(op == FASMultigrid::restrict_half_weighting)
+  {
+    idx_t n_coarsened = (rx == 2) + (ry == 2) + (rz == 2);
+    real_t w_face = 0.5 / (2 * n_coarsened);
+    real_t r = 0.5 * f[0];
+    if(rx == 2)
+      r += w_face * (f[-sx] + f[sx]);
+    if(ry == 2)
+      r += w_face * (f[-sy] + f[sy]);
+    if(rz == 2)
+      r += w_face * (f[-1] + f[1]);
+    return r;
+  }
+
+  // full weighting: y, then x, then z
+  real_t x[3] = {0.0, 0.0, 0.0};
+  for(idx_t c = 0; c < 3; c++)
+  {
+    if(rz == 1 && c != 1)
+      continue;
+    real_t y[3] = {0.0, 0.0, 0.0};
+    for(idx_t a = 0; a < 3; a++)
+    {
+      if(rx == 1 && a != 1)
+        continue;
+      const real_t * f_0 = f + (a - 1)*sx + (c - 1);
+      y[a] = (ry == 2) ? 0.25 * (f_0[-sy] + f_0[sy]) + 0.5 * f_0[0] : f_0[0];
+    }
+    x[c] = (rx == 2) ? 0.25 * (y[0] + y[2]) + 0.5 * y[1] : y[1];
+  }
+  return (rz == 2) ? 0.25 * (x[0] + x[2]) + 0.5 * x[1] : x[1];
+}
+
+/**
+ * @brief      Compute coarse_src and u of all equations on a coarser grid
+ * @details The fine grid residual is never stored as a whole: for each
+ *  tile of the coarse grid, the residual is evaluated at the fine points
+ *  the restriction of the tile reads into a buffer that stays in cache,
+ *  restricted, and added to the coarse equation evaluated at the same
+ *  coarse points, giving the FAS source
+ *  coarse_src = F(R u) + R(coarse_src - F(u)) in a single pass.
+ *  Equations are independent once u is restricted, so (equation, tile)
+ *  pairs are handed to threads together.
+ * @param[in]  fine_depth  depth of grid to coarsen
+ * @param[in]  restrict_u  whether to restrict u first; coarse_src
+ *  depends on all variables, so otherwise all u must be restricted
+ */
+void FASMultigrid::_computeCoarseRestrictions(idx_t fine_depth, bool restrict_u)
+{
+  if(restrict_u)
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      _restrictFine2coarse(u_h[eqn_id], fine_depth);
+
+  idx_t fine_idx = _dIdx(fine_depth);
+  idx_t coarse_idx = fine_idx - 1;
+
+  idx_t n_fine_x = nx_h[fine_idx], n_fine_y = ny_h[fine_idx], n_fine_z = nz_h[fine_idx];
+  idx_t n_coarse_x = nx_h[coarse_idx], n_coarse_y = ny_h[coarse_idx],
+        n_coarse_z = nz_h[coarse_idx];
+  idx_t rx = rx_h[fine_idx], ry = ry_h[fine_idx], rz = rz_h[fine_idx];
+  restriction_t op = cycle_cfg.restriction[fine_idx];
+
+  // fine points read around those coinciding with coarse points
+  idx_t hx = (op != restrict_injection && rx == 2),
+        hy = (op != restrict_injection && ry == 2),
+        hz = (op != restrict_injection && rz == 2);
+  // injection reads only those, so the buffer skips the others
+  idx_t gx = (op == restrict_injection) ? rx : 1,
+        gy = (op == restrict_injection) ? ry : 1,
+        gz = (op == restrict_injection) ? rz : 1;
+
+  // buffer of a tile holds about 8 fine points per coarse point
+  fas_tiling tiling = fas_plan_block_tiling(n_coarse_x, n_coarse_y, n_coarse_z, 1, 8,
+    tile_cache_bytes, omp_get_max_threads());
+
+  bool fine_padded = _beginPaddedSweep(fine_idx, false);
+  bool coarse_padded = _beginPaddedSweep(coarse_idx, false);
+
+  #pragma omp parallel default(shared)
+  {
+    std::vector<real_t> residual;
+
+    #pragma omp for
+    for(idx_t task = 0; task < u_n * tiling.n_tiles; task++)
+    {
+      idx_t eqn_id = task / tiling.n_tiles, tile = task % tiling.n_tiles;
+      fas_grid_t & fine_src = coarse_src_h[eqn_id][fine_idx];
+      fas_grid_t & coarse_src = coarse_src_h[eqn_id][coarse_idx];
+
+      idx_t ci_0 = FAS_TILE_BEGIN(tiling, tile, x), ci_1 = FAS_TILE_END(tiling, tile, x);
+      idx_t cj_0 = FAS_TILE_BEGIN(tiling, tile, y), cj_1 = FAS_TILE_END(tiling, tile, y);
+      idx_t ck_0 = FAS_TILE_BEGIN(tiling, tile, z), ck_1 = FAS_TILE_END(tiling, tile, z);
+
+      // fine box read by the tile, every g-th point along each axis
+      idx_t fi_0 = rx*ci_0 - hx, fj_0 = ry*cj_0 - hy, fk_0 = rz*ck_0 - hz;
+      idx_t bx = (rx*(ci_1 - 1) + hx - fi_0) / gx + 1, by = (ry*(cj_1 - 1) + hy - fj_0) / gy + 1,
+            bz = (rz*(ck_1 - 1) + hz - fk_0) / gz + 1;
+      residual.resize(bx * by * bz);
+
+      for(idx_t a = 0; a < bx; a++)
+        for(idx_t b = 0; b < by; b++)
+          for(idx_t c = 0; c < bz; c++)
+          {
+            idx_t fi = (fi_0 + gx*a + n_fine_x) % n_fine_x, fj = (fj_0 + gy*b + n_fine_y) % n_fine_y,
+                  fk = (fk_0 + gz*c + n_fine_z) % n_fine_z;
+            residual[(a*by + b)*bz + c] = fine_src[(fi*n_fine_y + fj)*n_fine_z + fk]
+              - _evaluateEllipticEquationPt(eqn_id, fine_idx, fi, fj, fk);
+          }
+
+      for(idx_t ci = ci_0; ci < ci_1; ci++)
+        for(idx_t cj = cj_0; cj < cj_1; cj++)
+          for(idx_t ck = ck_0; ck < ck_1; ck++)
+          {
+            const real_t * f = &residual[(((rx*ci - fi_0)/gx)*by + (ry*cj - fj_0)/gy)*bz
+              + (rz*ck - fk_0)/gz];
+            idx_t idx = (ci*n_coarse_y + cj)*n_coarse_z + ck;
+            coarse_src[idx] = _evaluateEllipticEquationPt(eqn_id, coarse_idx, ci, cj, ck)
+              + fas_restrict_point(op, f, by*bz, bz, rx, ry, rz);
+          }
+    }
+  }
+
+  if(coarse_padded)
+    _endPaddedSweep(coarse_idx);
+  if(fine_padded)
+    _endPaddedSweep(fine_idx);
+}
+
+/**
+ * @brief      Convert a grid containing an approximate solution
+ *  to a grid containing the solution error, err = true - appx.
+ *
+ * @param      appx_to_err_h  grid heirarchy containing appx'n to convert
+ * @param      exact_soln_h   heirarchy containing exact solution
+ * @param[in]  depth          depth to perform computation at
+ */  
+void FASMultigrid::_changeApproximateSolutionToError(fas_heirarchy_t  appx_to_err_h,
+    fas_heirarchy_t  exact_soln_h, idx_t depth)
+{
+  idx_t i, j, k;
+
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+
+  fas_grid_t & appx_to_err = appx_to_err_h[depth_idx];
+  fas_grid_t & exact_soln = exact_soln_h[depth_idx];
+
+  #pragma omp parallel for default(shared) private(i,j,k)
+  FAS_TILED_LOOP3(i, j, k, tilings[depth_idx])
+  {
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+    appx_to_err[idx] = exact_soln[idx] - appx_to_err[idx];
+  }
+}
+
+/**
+ * @brief Compute and add in correction to fine grid from error
+ * on coarser grid; replace error with appx. solution
+ * 
+ * @param err_h grid heirarchy containing error
+ * @param err2appx_h heirarchy containing approximate solution
+ * @param fine_depth depth of fine grid to correct
+ */
+void FASMultigrid::_correctFineFromCoarseErr_Err2Appx(fas_heirarchy_t err2appx_h,
+          fas_heirarchy_t  appx_soln_h, idx_t fine_depth)
+{
+  idx_t i, j, k;
+  idx_t coarse_depth = fine_depth-1;
+
+  idx_t fine_depth_idx = _dIdx(fine_depth);
+
+  idx_t n_fine_x = nx_h[fine_depth_idx], n_fine_y = ny_h[fine_depth_idx], n_fine_z = nz_h[fine_depth_idx];
+  _interpolateCoarse2fine(err2appx_h, coarse_depth);
+
+  fas_grid_t & err2appx = err2appx_h[fine_depth_idx];
+  fas_grid_t & appx_soln = appx_soln_h[fine_depth_idx];
+
+  #pragma omp parallel for default(shared) private(i,j,k)
+  FAS_TILED_LOOP3(i, j, k, tilings[fine_depth_idx])
+  {
+    idx_t idx = H_INDEX(i, j, k, n_fine_x,n_fine_y,n_fine_z);
+    // appx. solution in intermediate variable
+    real_t appx_val = appx_soln[idx];
+    // correct approximate solution with error
+    appx_soln[idx] += err2appx[idx];
+    // store approximate solution in err2appx
+    err2appx[idx] = appx_val;
+  }
+}
+
+/**
+ * @brief correct u at a fine depth from the coarse solution, optionally
+ *  evaluating the residual of the corrected u
+ * @details u += P(u_coarse - coarse_appx) for all variables in a single
+ *  pass over the fine grid; the coarse error is formed while
+ *  interpolating each fine row and stored on neither grid. Each thread
+ *  corrects a slab of x-planes in order and evaluates the residual at
+ *  plane i - R, R being the stencil radius (see _stencilRadius()),
+ *  right after plane i is corrected, while those planes are still in
+ *  cache. The R planes at
+ *  either end of a slab depend on neighbouring slabs and are evaluated
+ *  once all threads are done correcting. The residual is stored as by
+ *  _evaluateRelaxResidual(), starting the post-smoothing relaxation.
+ *
+ * @param fine_depth depth to correct
+ * @param with_residual whether to evaluate the residual
+ * @return norms of residual, zero if not evaluated
+ */
+fas_residual_norms FASMultigrid::_correctFromCoarse(idx_t fine_depth, bool with_residual)
+{
+  idx_t fine_idx = _dIdx(fine_depth);
+  idx_t coarse_idx = fine_idx - 1;
+  idx_t n_fine_x = nx_h[fine_idx], n_fine_y = ny_h[fine_idx], n_fine_z = nz_h[fine_idx];
+  bool mixed;
+  idx_t R = _stencilRadius(fine_idx, mixed);
+  prolong_row_fn prolong = prolongation_row_ops[cycle_cfg.prolongation[fine_idx]];
+
+  real_t max_abs = 0.0, sum_sq = 0.0;
+
+  #pragma omp parallel default(shared) reduction(max:max_abs) reduction(+:sum_sq)
+  {
+    std::vector<real_t> row;
+    idx_t n_threads = omp_get_num_threads(), thread = omp_get_thread_num();
+    idx_t x_0 = n_fine_x * thread / n_threads, x_1 = n_fine_x * (thread + 1) / n_threads;
+
+    auto residual_plane = [&](idx_t fi) {
+      for(idx_t fj = 0; fj < n_fine_y; fj++)
+        for(idx_t fk = 0; fk < n_fine_z; fk++)
+        {
+          idx_t idx = (fi*n_fine_y + fj)*n_fine_z + fk;
+          for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+          {
+            real_t temp = _evaluateEllipticEquationPt(eqn_id, fine_idx, fi, fj, fk)
+              - coarse_src_h[eqn_id][fine_idx][idx];
+            jac_rhs_h[eqn_id][fine_idx][idx] = -temp;
+            max_abs = std::max(max_abs, std::fabs(temp));
+            sum_sq += temp * temp;
+          }
+        }
+    };
+
+    for(idx_t fi = x_0; fi < x_1; fi++)
+    {
+      for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+        for(idx_t fj = 0; fj < n_fine_y; fj++)
+        {
+          idx_t r = fi*n_fine_y + fj;
+          (this->*prolong)(fine_idx, u_h[eqn_id][coarse_idx]._array,
+            coarse_appx_h[eqn_id][coarse_idx]._array, r, row,
+            u_h[eqn_id][fine_idx]._array + r*n_fine_z, true);
+        }
+
+      if(with_residual && fi - R >= x_0 + R)
+        residual_plane(fi - R);
+    }
+
+    if(with_residual)
+    {
+      #pragma omp barrier
+      for(idx_t fi = x_0; fi < std::min(x_0 + R, x_1); fi++)
+        residual_plane(fi);
+      for(idx_t fi = std::max(x_0 + R, x_1 - R); fi < x_1; fi++)
+        residual_plane(fi);
+    }
+  }
+
+  fas_residual_norms norms;
+  norms.max_abs = max_abs;
+  norms.sum_sq = sum_sq;
+  return norms;
+}
+
+/**
+ * @brief Copy grid from one heirarchy to another
+ * 
+ * @param from_h copy from this heirarchy
+ * @param to_h to this heirarchy
+ * @param depth at this depth
+ */
+void FASMultigrid::_copyGrid(fas_heirarchy_t from_h[], fas_heirarchy_t to_h[], idx_t eqn_id, idx_t depth)
+{
+  idx_t depth_idx = _dIdx(depth);
+  fas_grid_t & from = from_h[eqn_id][depth_idx];
+  fas_grid_t & to = to_h[eqn_id][depth_idx];
+  to = from;
+}
+
+/**
+ * @brief evaluate |F(u + \lambda v) - coarse_src|^2 for several \lambda
+ * @details All candidates share one sweep over the grid. Stencils are
+ *  linear, so S(u + \lambda v) = S(u) + \lambda S(v) is formed from a
+ *  single application of each stencil to u and v. u is left unchanged.
+ *  Equations with user supplied kernels cannot be evaluated this way;
+ *  for those u is shifted for every candidate and restored afterwards.
+ *  For a single candidate the residual can be kept: it is stored as
+ *  -(F(u + \lambda v) - coarse_src) in jac_rhs, ready for the next
+ *  Newton step if the candidate is accepted.
+ *
+ * @param depth_idx index of depth
+ * @param lambdas candidate step lengths
+ * @param n number of candidates, at most FAS_MAX_LINE_SEARCH_CANDIDATES
+ * @param sums squared norms, one per candidate
+ * @param max_residual if not NULL (and n is 1), residual is stored in
+ *  jac_rhs and its max. norm here
+ */
+void FASMultigrid::_evaluateShiftedNorms(idx_t depth_idx, const real_t * lambdas,
+  idx_t n, real_t * sums, real_t * max_residual)
+{
+  idx_t i, j, k;
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+
+  for(idx_t c = 0; c < n; c++)
+    sums[c] = 0.0;
+
+  bool use_tape = true;
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    if(eqn_kernels[eqn_id] != NULL && eqn_kernels[eqn_id] != jit_kernels[eqn_id])
+      use_tape = false;
+
+  if(!use_tape)
+  {
+    real_t shift = 0.0;
+    for(idx_t c = 0; c < n; c++)
+    {
+      _shiftSolution(depth_idx, lambdas[c] - shift);
+      shift = lambdas[c];
+
+      if(max_residual != NULL)
+      {
+        fas_residual_norms norms = _evaluateRelaxResidual(depth_idx);
+        sums[c] = norms.sum_sq;
+        *max_residual = norms.max_abs;
+        continue;
+      }
+
+      sums[c] = fas_reduce_residuals(u_n, tilings[depth_idx],
+        [&](idx_t eqn_id, idx_t i, idx_t j, idx_t k, idx_t idx) {
+          return _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k)
+            - coarse_src_h[eqn_id][depth_idx][idx];
+        }).sum_sq;
+    }
+    _shiftSolution(depth_idx, -shift);
+    return;
+  }
+
+  bool padded = _beginPaddedSweep(depth_idx, true);
+  equation_tape & tape = _tape(depth_idx);
+  FASPartialSums partial_sums(n);
+  bool store = (max_residual != NULL);
+  real_t max_res = 0.0;
+
+  #pragma omp parallel default(shared) private(i,j,k)
+  {
+    real_t * local_sums = partial_sums.local();
+
+    #pragma omp for reduction(max:max_res)
+    FAS_TILED_LOOP3(i, j, k, tilings[depth_idx])
+    {
+      idx_t idx = tape.xo[i] + tape.yo[j] + tape.zo[k];
+      idx_t grid_idx = H_INDEX(i, j, k, nx, ny, nz);
+      for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      {
+        real_t res[FAS_MAX_LINE_SEARCH_CANDIDATES] = {0.0};
+
+        for(idx_t m = tape.eqn_mol_begin[eqn_id]; m < tape.eqn_mol_begin[eqn_id+1]; m++)
+        {
+          tape_mol & mol = tape.mols[m];
+          real_t val[FAS_MAX_LINE_SEARCH_CANDIDATES];
+          real_t coef = mol.const_coef;
+          if(mol.rho != NULL)
+            coef *= mol.rho[idx];
+          for(idx_t c = 0; c < n; c++)
+            val[c] = coef;
+
+          for(idx_t o = mol.poly_begin; o < mol.poly_end; o++)
+          {
+            tape_op & op = tape.ops[o];
+            for(idx_t c = 0; c < n; c++)
+              val[c] *= fas_pow(op.pow_class, op.pow_n, op.value,
+                op.u[idx] + lambdas[c] * op.v[idx]);
+          }
+
+          for(idx_t o = mol.sten_begin; o < mol.sten_end; o++)
+          {
+            tape_op & op = tape.ops[o];
+            real_t su, sv;
+            FAS_TAPE_STENCIL(su, tape, op, op.u, i, j, k, idx);
+            FAS_TAPE_STENCIL(sv, tape, op, op.v, i, j, k, idx);
+            for(idx_t c = 0; c < n; c++)
+              val[c] *= su + lambdas[c] * sv;
+          }
+
+          for(idx_t c = 0; c < n; c++)
+            res[c] += val[c];
+        }
+
+        for(idx_t c = 0; c < n; c++)
+        {
+          real_t temp = res[c] - coarse_src_h[eqn_id][depth_idx][grid_idx];
+          local_sums[c] += temp * temp;
+        }
+        if(store)
+        {
+          real_t temp = res[0] - coarse_src_h[eqn_id][depth_idx][grid_idx];
+          jac_rhs_h[eqn_id][depth_idx][grid_idx] = -temp;
+          max_res = std::max(max_res, std::fabs(temp));
+        }
+      }
+    }
+
+  }
+  partial_sums.total(sums);
+  if(store)
+    *max_residual = max_res;
+
+  if(padded)
+    _endPaddedSweep(depth_idx);
+}
+
+/**
+ * @brief u += shift * v for all variables at a depth
+ */
+void FASMultigrid::_shiftSolution(idx_t depth_idx, real_t shift)
+{
+  idx_t pts = nx_h[depth_idx] * ny_h[depth_idx] * nz_h[depth_idx];
+
+  #pragma omp parallel for collapse(2)
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    for(idx_t idx = 0; idx < pts; idx++)
+      u_h[eqn_id][depth_idx][idx] += shift * damping_v_h[eqn_id][depth_idx][idx];
+}
+
+/**
+ * @brief find a damping factor \lambda in (0, 1] for the step v and
+ *  update u += \lambda v
+ * @details Line search used is set by setLineSearch():
+ *  line_search_scan tries \lambda = 1, 0.99, ..., 0.01 until
+ *  |F(u + \lambda v)| < |F(u)|, line_search_candidates at a time;
+ *  line_search_armijo backtracks from \lambda = 1 with quadratic, then
+ *  cubic interpolation until the Armijo condition holds;
+ *  line_search_multi tests \lambda = 1, 1/2, 1/4, ... against the Armijo
+ *  condition, line_search_candidates per sweep, taking the largest.
+ *  The Armijo condition uses the slope -2|F(u)|^2 of |F(u + \lambda v)|^2,
+ *  exact when v solves the Jacobian equation.
+ *  Statistics of the search are kept in last_line_search. When the
+ *  accepted \lambda was evaluated on its own, the residual at the new u
+ *  is left in jac_rhs (see last_line_search.residual_stored).
+ *
+ * @param depth
+ * @param norm |F(u) - coarse_src|^2
+ * @return whether a suitable \lambda was found; u is unchanged if not
+ */
+bool FASMultigrid::_getLambda( idx_t depth, real_t norm)
+{
+  idx_t depth_idx = _dIdx(depth);
+  real_t slope = -2.0 * norm;
+  real_t lambdas[FAS_MAX_LINE_SEARCH_CANDIDATES], sums[FAS_MAX_LINE_SEARCH_CANDIDATES];
+  idx_t n = std::max((idx_t) 1, std::min(line_search_candidates,
+    (idx_t) FAS_MAX_LINE_SEARCH_CANDIDATES));
+
+  line_search_result & result = last_line_search;
+  result.lambda = 0.0;
+  result.evaluations = 0;
+  result.sweeps = 0;
+  result.success = false;
+  result.residual_stored = false;
+
+  if(line_search == line_search_armijo)
+  {
+    real_t lambda = 1.0, prev_lambda = 0.0, prev_f = 0.0;
+    for(idx_t s = 0; s < line_search_max_evaluations; s++)
+    {
+      real_t f, max_res;
+      _evaluateShiftedNorms(depth_idx, &lambda, 1, &f, &max_res);
+      result.evaluations++;
+      result.sweeps++;
+
+      if(f <= norm + line_search_c * lambda * slope)
+      {
+        result.lambda = lambda;
+        result.success = true;
+        result.residual_stored = true;
+        result.max_residual = max_res;
+        result.norm = f;
+        break;
+      }
+
+      real_t new_lambda;
+      if(s == 0)
+      {
+        // minimum of quadratic through f(0), f'(0), f(lambda)
+        new_lambda = -slope * lambda * lambda / (2.0 * (f - norm - slope * lambda));
+      }
+      else
+      {
+        // minimum of cubic through f(0), f'(0) and last two values
+        real_t r1 = f - norm - slope * lambda;
+        real_t r2 = prev_f - norm - slope * prev_lambda;
+        real_t a = (r1 / (lambda * lambda) - r2 / (prev_lambda * prev_lambda))
+          / (lambda - prev_lambda);
+        real_t b = (-prev_lambda * r1 / (lambda * lambda)
+          + lambda * r2 / (prev_lambda * prev_lambda)) / (lambda - prev_lambda);
+        real_t disc = b * b - 3.0 * a * slope;
+        if(a == 0.0)
+          new_lambda = -slope / (2.0 * b);
+        else if(disc < 0.0)
+          new_lambda = 0.5 * lambda;
+        else if(b <= 0.0)
+          new_lambda = (-b + std::sqrt(disc)) / (3.0 * a);
+        else
+          new_lambda = -slope / (b + std::sqrt(disc));
+      }
+
+      // safeguard, also catches NaN from non-finite residuals
+      if(!(new_lambda <= 0.5 * lambda))
+        new_lambda = 0.5 * lambda;
+      if(!(new_lambda >= 0.1 * lambda))
+        new_lambda = 0.1 * lambda;
+
+      prev_lambda = lambda;
+      prev_f = f;
+      lambda = new_lambda;
+    }
+  }
+  else
+  {
+    // batches of candidates, largest first; a full step is usually
+    // accepted, so it is tried on its own
+    idx_t total = (line_search == line_search_scan) ? 100 : line_search_max_evaluations;
+    idx_t batch;
+    for(idx_t s = 0; s < total && !result.success; s += batch)
+    {
+      batch = (s == 0) ? 1 : std::min(n, total - s);
+      for(idx_t c = 0; c < batch; c++)
+        lambdas[c] = (line_search == line_search_scan) ?
+          1.0 - 0.01 * (real_t)(s + c) : std::pow(0.5, (real_t)(s + c));
+
+      real_t max_res = 0.0;
+      _evaluateShiftedNorms(depth_idx, lambdas, batch, sums, (batch == 1) ? &max_res : NULL);
+      result.evaluations += batch;
+      result.sweeps++;
+
+      for(idx_t c = 0; c < batch; c++)
+      {
+        bool accept = (line_search == line_search_scan) ? (sums[c] <= norm)
+          : (sums[c] <= norm + line_search_c * lambdas[c] * slope);
+        if(accept)
+        {
+          result.lambda = lambdas[c];
+          result.success = true;
+          result.residual_stored = (batch == 1);
+          result.max_residual = max_res;
+          result.norm = sums[c];
+          break;
+        }
+      }
+    }
+  }
+
+  line_search_evaluations += result.evaluations;
+
+  if(result.success)
+    _shiftSolution(depth_idx, result.lambda);
+
+  return result.success;
+}
+
+/**
+ * @brief select line search used by the newton type relaxation schemes
+ *
+ * @param type line search (see line_search_t)
+ * @param candidates step lengths evaluated per sweep by batched searches
+ */
+void FASMultigrid::setLineSearch(line_search_t type, idx_t candidates)
+{
+  line_search = type;
+  line_search_candidates = std::max((idx_t) 1, std::min(candidates,
+    (idx_t) FAS_MAX_LINE_SEARCH_CANDIDATES));
+}
+
+/**
+ * @brief value of \sum_u \partial F(u) / \partial u * v at a point
+ *
+ * @param id of equation which needs to be calculated
+ * @param index of depth
+ * @param x grid index
+ * @param y grid index
+ * @param z grid index
+ * @param frozen whether the Jacobian at this depth is stored
+ */
+real_t FASMultigrid::_evaluateJacobianProductPt(idx_t eqn_id, idx_t depth_idx,
+  idx_t i, idx_t j, idx_t k, bool frozen)
+{
+  if(frozen)
+    return _evaluateFrozenDerEquation(eqn_id, depth_idx, i, j, k);
+
+  real_t res = 0.0;
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+    res += _evaluateDerEllipticEquation(eqn_id, depth_idx, i, j, k, u_id);
+  return res;
+}
+
+/**
+ * @brief single damped Jacobi sweep (weight FAS_JACOBI_WEIGHT) of
+ *  J v = jac_rhs for all equations, updating damping_v
+ * @details New values are written to temporal_scratch and copied back
+ *  once an equation is swept, so every point is updated from the
+ *  previous iterate and the result does not depend on the tiling or
+ *  the number of threads. Equations are swept one after another, each
+ *  seeing the updated v of the ones before, unless concurrent_equations
+ *  is set (see setConcurrentEquations()): then (equation, tile) pairs
+ *  are handed to threads together and every equation reads the v of the
+ *  previous sweep.
+ *
+ * @param depth_idx index of depth
+ * @param frozen whether the Jacobian at this depth is stored
+ */
+void FASMultigrid::_jacobiSweep(idx_t depth_idx, bool frozen)
+{
+  idx_t eqn_id, i, j, k;
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  idx_t pts = nx * ny * nz;
+
+  if((idx_t) temporal_scratch.size() < u_n * pts)
+    temporal_scratch.resize(u_n * pts);
+  real_t * out = &temporal_scratch[0];
+
+  auto update = [&](idx_t eqn_id, idx_t i, idx_t j, idx_t k) {
+    idx_t idx = H_INDEX(i,j,k,nx,ny,nz);
+    fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+    fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
+
+    if(frozen)
+    {
+      real_t * diag = linearizations[depth_idx].diag[eqn_id];
+      real_t jv = _evaluateFrozenDerEquation(eqn_id, depth_idx, i, j, k);
+      out[eqn_id*pts + idx] = damping_v[idx] + FAS_JACOBI_WEIGHT
+        * (jv - jac_rhs[idx]) / (-diag[idx]);
+      return;
+    }
+
+    real_t coef_a =0, coef_b = 0, temp = 0;
+    _evaluateIterationForJacEquation(eqn_id, depth_idx, coef_a, coef_b, i, j, k, eqn_id);
+    for(idx_t u_id = 0; u_id < u_n; u_id++)
+    {
+      if(u_id != eqn_id)
+        temp += _evaluateDerEllipticEquation(eqn_id, depth_idx, i, j, k, u_id);
+    }
+    out[eqn_id*pts + idx] = damping_v[idx] + FAS_JACOBI_WEIGHT
+      * ((coef_a - jac_rhs[idx] + temp)/ (-coef_b) - damping_v[idx]);
+  };
+
+  auto copy_back = [&](idx_t eqn_id) {
+    fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+    #pragma omp parallel for
+    for(idx_t idx = 0; idx < pts; idx++)
+      damping_v[idx] = out[eqn_id*pts + idx];
+  };
+
+  if(concurrent_equations)
+  {
+    #pragma omp parallel for default(shared) private(eqn_id,i,j,k)
+    FAS_EQN_TILED_LOOP3(eqn_id, i, j, k, u_n, tilings[depth_idx])
+      update(eqn_id, i, j, k);
+    for(eqn_id = 0; eqn_id < u_n; eqn_id++)
+      copy_back(eqn_id);
+    return;
+  }
+
+  for(eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    #pragma omp parallel for default(shared) private(i,j,k)
+    FAS_TILED_LOOP3(i, j, k, tilings[depth_idx])
+      update(eqn_id, i, j, k);
+    copy_back(eqn_id);
+  }
+}
+
+/**
+ * @brief several Jacobi sweeps of the Jacobian equation
+ * @details with a stored Jacobian, groups of up to jacobi_fused_sweeps
+ *  sweeps are performed tile by tile (see _temporalJacobiSweeps())
+ *
+ * @param depth_idx index of depth
+ * @param frozen whether the Jacobian at this depth is stored
+ * @param n_sweeps number of sweeps
+ */
+void FASMultigrid::_jacobiSweeps(idx_t depth_idx, bool frozen, idx_t n_sweeps)
+{
+  while(n_sweeps > 0)
+  {
+    idx_t fused = std::min(n_sweeps, jacobi_fused_sweeps);
+    if(frozen && fused > 1)
+      _temporalJacobiSweeps(depth_idx, fused);
+    else
+    {
+      fused = 1;
+      _jacobiSweep(depth_idx, frozen);
+    }
+    n_sweeps -= fused;
+  }
+}
+
+/**
+ * @brief temporally blocked Jacobi sweeps of a stored Jacobian
+ * @details Each tile is copied together with a halo of n_sweeps stencil
+ *  radii into a thread-local buffer, which is swept n_sweeps times while
+ *  in cache, the updated region shrinking by one radius per sweep, so
+ *  that the tile interior has seen n_sweeps full sweeps when it is
+ *  written back. Grids are thus streamed
+ *  from memory once per n_sweeps sweeps instead of once per sweep, at the
+ *  cost of recomputing halos. Each sweep reads one buffer and writes a
+ *  second one, the two being swapped after each equation (after all of
+ *  them with concurrent_equations), so the result is that of n_sweeps
+ *  calls of _jacobiSweep() for any tiling.
+ *
+ * @param depth_idx index of depth
+ * @param n_sweeps number of sweeps
+ */
+void FASMultigrid::_temporalJacobiSweeps(idx_t depth_idx, idx_t n_sweeps)
+{
+  equation_tape & tape = tapes[depth_idx];
+  frozen_linearization & lin = linearizations[depth_idx];
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  idx_t pts = nx * ny * nz;
+  const idx_t R = tape.radius;
+  const idx_t H = n_sweeps * R;
+
+  // v, rhs and diagonal of each variable plus coefficient grids
+  fas_tiling tiling = fas_plan_block_tiling(nx, ny, nz, H,
+    3 * u_n + (idx_t) lin.terms.size(), tile_cache_bytes, omp_get_max_threads());
+
+  if((idx_t) temporal_scratch.size() < u_n * pts)
+    temporal_scratch.resize(u_n * pts);
+  real_t * out = &temporal_scratch[0];
+
+  #pragma omp parallel default(shared)
+  {
+    std::vector<real_t> lv, lw;
+    std::vector<real_t *> cur(u_n), next(u_n);
+    std::vector<idx_t> xw, yw, zw, loff(tape.taps.size());
+
+    #pragma omp for
+    for(idx_t tile = 0; tile < tiling.n_tiles; tile++)
+    {
+      idx_t x0 = FAS_TILE_BEGIN(tiling, tile, x) - H, ex = FAS_TILE_END(tiling, tile, x) + H - x0;
+      idx_t y0 = FAS_TILE_BEGIN(tiling, tile, y) - H, ey = FAS_TILE_END(tiling, tile, y) + H - y0;
+      idx_t z0 = FAS_TILE_BEGIN(tiling, tile, z) - H, ez = FAS_TILE_END(tiling, tile, z) + H - z0;
+      idx_t epts = ex * ey * ez;
+
+      // periodically wrapped grid index of each buffer point
+      xw.resize(ex);
+      yw.resize(ey);
+      zw.resize(ez);
+      for(idx_t l = 0; l < ex; l++)
+        xw[l] = (((x0 + l) % nx + nx) % nx) * ny * nz;
+      for(idx_t l = 0; l < ey; l++)
+        yw[l] = (((y0 + l) % ny + ny) % ny) * nz;
+      for(idx_t l = 0; l < ez; l++)
+        zw[l] = ((z0 + l) % nz + nz) % nz;
+      for(idx_t t = 0; t < (idx_t) tape.taps.size(); t++)
+        loff[t] = (tape.taps[t].di * ey + tape.taps[t].dj) * ez + tape.taps[t].dk;
+
+      lv.resize(u_n * epts);
+      lw.resize(u_n * epts);
+      for(idx_t u_id = 0; u_id < u_n; u_id++)
+      {
+        fas_grid_t & damping_v = damping_v_h[u_id][depth_idx];
+        cur[u_id] = &lv[u_id*epts];
+        next[u_id] = &lw[u_id*epts];
+        for(idx_t li = 0; li < ex; li++)
+          for(idx_t lj = 0; lj < ey; lj++)
+            for(idx_t lk = 0; lk < ez; lk++)
+              cur[u_id][(li*ey + lj)*ez + lk] = damping_v[xw[li] + yw[lj] + zw[lk]];
+      }
+
+      for(idx_t s = 0; s < n_sweeps; s++)
+      {
+        // points at least one radius inside the region valid after sweep s-1
+        idx_t m = (s + 1) * R;
+        for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+        {
+          const real_t * v = cur[eqn_id];
+          real_t * v_new = next[eqn_id];
+          real_t * diag = lin.diag[eqn_id];
+          fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
+
+          for(idx_t li = m; li < ex - m; li++)
+            for(idx_t lj = m; lj < ey - m; lj++)
+              for(idx_t lk = m; lk < ez - m; lk++)
+              {
+                idx_t p = (li*ey + lj)*ez + lk;
+                idx_t g = xw[li] + yw[lj] + zw[lk];
+                real_t jv = 0.0;
+                for(idx_t t = lin.eqn_term_begin[eqn_id]; t < lin.eqn_term_begin[eqn_id+1]; t++)
+                {
+                  frozen_term & ft = lin.terms[t];
+                  const real_t * w = cur[ft.u_id] + p;
+                  real_t sv = 0.0;
+                  if(ft.op < 0)
+                    sv = w[0];
+                  else
+                    for(idx_t tp = tape.ops[ft.op].tap_begin; tp < tape.ops[ft.op].tap_end; tp++)
+                      sv += tape.taps[tp].coef * w[loff[tp]];
+                  jv += ft.coef[g] * sv;
+                }
+                v_new[p] = v[p] + FAS_JACOBI_WEIGHT * (jv - jac_rhs[g]) / (-diag[g]);
+              }
+
+          // only the region just written is read by later sweeps
+          if(!concurrent_equations)
+            std::swap(cur[eqn_id], next[eqn_id]);
+        }
+
+        if(concurrent_equations)
+          std::swap(cur, next);
+      }
+
+      for(idx_t u_id = 0; u_id < u_n; u_id++)
+        for(idx_t li = H; li < ex - H; li++)
+          for(idx_t lj = H; lj < ey - H; lj++)
+            for(idx_t lk = H; lk < ez - H; lk++)
+              out[u_id*pts + xw[li] + yw[lj] + zw[lk]] = cur[u_id][(li*ey + lj)*ez + lk];
+    }
+  }
+
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+  {
+    fas_grid_t & damping_v = damping_v_h[u_id][depth_idx];
+    #pragma omp parallel for
+    for(idx_t idx = 0; idx < pts; idx++)
+      damping_v[idx] = out[u_id*pts + idx];
+  }
+}
+
+/**
+ * @brief number of Jacobi sweeps of the Jacobian equation fused into
+ *  one pass over the grids
+ * @details only applies to depths with a stored Jacobian (see
+ *  setLinearizationMemoryBudget()); the convergence of the Jacobian
+ *  equation is then checked every n_sweeps sweeps. 1 disables fusing.
+ *
+ * @param n_sweeps sweeps per pass
+ */
+void FASMultigrid::setTemporalBlocking(idx_t n_sweeps)
+{
+  jacobi_fused_sweeps = std::max(n_sweeps, (idx_t) 1);
+}
+
+/**
+ * @brief relax the Jacobian equations of a system concurrently
+ * @details Work that is independent for each equation (residuals,
+ *  norms, coarse grid sources, Jacobian products) always runs over
+ *  (equation, tile) pairs. Jacobi and line sweeps couple the equations
+ *  through v; by default each equation is swept after the previous one
+ *  and sees its update. With enable, all equations are swept at once
+ *  from the v of the previous sweep (line sweeps: of the previous
+ *  colour), i.e. block Jacobi over the equations. This keeps threads
+ *  busy on coarse grids with few tiles per equation; results stay
+ *  independent of scheduling but may need more sweeps.
+ *
+ * @param enable whether to sweep equations concurrently
+ */
+void FASMultigrid::setConcurrentEquations(bool enable)
+{
+  concurrent_equations = enable;
+}
+
+/**
+ * @brief solve a periodic (cyclic) tridiagonal system
+ * @details a[l] x[l-1] + b[l] x[l] + c[l] x[l+1] = r[l], indexes wrapped;
+ *  Thomas algorithm with a Sherman-Morrison correction for the corners
+ *
+ * @param n number of unknowns
+ * @param work scratch space of at least 3n values
+ */
+static void fas_solve_cyclic_tridiagonal(idx_t n, const real_t * a, const real_t * b,
+  const real_t * c, const real_t * r, real_t * x, real_t * work)
+{
+  if(n == 1)
+  {
+    x[0] = r[0] / (a[0] + b[0] + c[0]);
+    return;
+  }
+  if(n == 2)
+  {
+    real_t m01 = a[0] + c[0], m10 = a[1] + c[1];
+    real_t det = b[0] * b[1] - m01 * m10;
+    x[0] = (r[0] * b[1] - m01 * r[1]) / det;
+    x[1] = (b[0] * r[1] - m10 * r[0]) / det;
+    return;
+  }
+
+  // A = T + u v^T with u = (gamma, 0, ..., 0, c[n-1]), v = (1, 0, ..., 0, a[0] / gamma)
+  real_t * cp = work, * y = work + n, * z = work + 2*n;
+  real_t gamma = -b[0];
+  real_t b0 = b[0] - gamma, bn = b[n-1] - c[n-1] * a[0] / gamma;
+
+  // forward sweep for both right hand sides r and u
+  real_t denom = b0;
+  cp[0] = c[0] / denom;
+  y[0] = r[0] / denom;
+  z[0] = gamma / denom;
+  for(idx_t l = 1; l < n; l++)
+  {
+    real_t bl = (l == n-1) ? bn : b[l];
+    denom = bl - a[l] * cp[l-1];
+    cp[l] = c[l] / denom;
+    y[l] = (r[l] - a[l] * y[l-1]) / denom;
+    z[l] = ((l == n-1 ? c[n-1] : 0.0) - a[l] * z[l-1]) / denom;
+  }
+  for(idx_t l = n - 2; l >= 0; l--)
+  {
+    y[l] -= cp[l] * y[l+1];
+    z[l] -= cp[l] * z[l+1];
+  }
+
+  real_t fact = (y[0] + a[0] / gamma * y[n-1]) / (1.0 + z[0] + a[0] / gamma * z[n-1]);
+  for(idx_t l = 0; l < n; l++)
+    x[l] = y[l] - fact * z[l];
+}
+
+/**
+ * @brief direction of lines relaxed by line relaxation at a depth
+ * @return line_axis if set, otherwise the direction with the smallest
+ *  grid spacing (strongest coupling), preferring z
+ */
+idx_t FASMultigrid::_lineAxis(idx_t depth_idx)
+{
+  if(line_axis != 0)
+    return line_axis;
+
+  real_t h[3] = { box_len[0] / nx_h[depth_idx], box_len[1] / ny_h[depth_idx],
+    box_len[2] / nz_h[depth_idx] };
+  idx_t axis = 3;
+  for(idx_t d = 2; d >= 1; d--)
+    if(h[d-1] < h[axis-1])
+      axis = d;
+  return axis;
+}
+
+/**
+ * @brief relax the Jacobian equation of one variable on one line
+ * @details The part of the stored Jacobian coupling a point to itself
+ *  and its two neighbours along the line is solved for exactly; all
+ *  other couplings use the current damping_v.
+ *
+ * @param depth_idx index of depth
+ * @param axis direction of line
+ * @param eqn_id id of equation (and variable relaxed)
+ * @param a first coordinate of line, perpendicular to axis
+ * @param b second coordinate of line, perpendicular to axis
+ * @param work scratch space
+ * @param out grid (indexed like damping_v) receiving the relaxed line;
+ *  NULL to update damping_v
+ */
+void FASMultigrid::_lineJacobianSolve(idx_t depth_idx, idx_t axis, idx_t eqn_id,
+  idx_t a, idx_t b, std::vector<real_t> & work, real_t * out)
+{
+  frozen_linearization & lin = linearizations[depth_idx];
+  equation_tape & tape = tapes[depth_idx];
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  idx_t n = (axis == 1) ? nx : ((axis == 2) ? ny : nz);
+  fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+  fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
+
+  work.resize(8 * n);
+  real_t * lo = &work[0], * di = &work[n], * up = &work[2*n], * r = &work[3*n],
+    * x = &work[4*n];
+
+  for(idx_t l = 0; l < n; l++)
+  {
+    idx_t i = (axis == 1) ? l : a, j = (axis == 2) ? l : ((axis == 1) ? a : b),
+      k = (axis == 3) ? l : b;
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+
+    lo[l] = di[l] = up[l] = 0.0;
+    for(idx_t t = lin.eqn_term_begin[eqn_id]; t < lin.eqn_term_begin[eqn_id+1]; t++)
+    {
+      frozen_term & ft = lin.terms[t];
+      if(ft.u_id != eqn_id)
+        continue;
+      if(ft.op < 0)
+      {
+        di[l] += ft.coef[idx];
+        continue;
+      }
+      for(idx_t tp = tape.ops[ft.op].tap_begin; tp < tape.ops[ft.op].tap_end; tp++)
+      {
+        const tape_tap & tap = tape.taps[tp];
+        idx_t o[4] = { 0, tap.di, tap.dj, tap.dk };
+        if(o[1] * (axis != 1) != 0 || o[2] * (axis != 2) != 0 || o[3] * (axis != 3) != 0)
+          continue;
+        if(o[axis] == 0)
+          di[l] += ft.coef[idx] * tap.coef;
+        else if(o[axis] == -1)
+          lo[l] += ft.coef[idx] * tap.coef;
+        else if(o[axis] == 1)
+          up[l] += ft.coef[idx] * tap.coef;
+      }
+    }
+
+    // move all couplings but those solved for to the right hand side
+    idx_t idx_m = H_INDEX(i - (axis == 1), j - (axis == 2), k - (axis == 3), nx, ny, nz);
+    idx_t idx_p = H_INDEX(i + (axis == 1), j + (axis == 2), k + (axis == 3), nx, ny, nz);
+    r[l] = jac_rhs[idx] - _evaluateFrozenDerEquation(eqn_id, depth_idx, i, j, k)
+      + lo[l] * damping_v[idx_m] + di[l] * damping_v[idx] + up[l] * damping_v[idx_p];
+  }
+
+  fas_solve_cyclic_tridiagonal(n, lo, di, up, r, x, &work[5*n]);
+
+  real_t * v = (out != NULL) ? out : damping_v._array;
+  for(idx_t l = 0; l < n; l++)
+  {
+    idx_t i = (axis == 1) ? l : a, j = (axis == 2) ? l : ((axis == 1) ? a : b),
+      k = (axis == 3) ? l : b;
+    v[H_INDEX(i, j, k, nx, ny, nz)] = x[l];
+  }
+}
+
+/**
+ * @brief one line Gauss-Seidel sweep of the stored Jacobian equation
+ * @details Lines run along _lineAxis(). They are coloured by their
+ *  position in the two other directions like points in
+ *  _nonlinearGaussSeidelSweep(), so lines of a colour are independent
+ *  and relaxed in parallel; if the colouring does not fit the periodic
+ *  grid, lines are relaxed one after another. With concurrent_equations
+ *  set, all equations of a colour are relaxed at once against the v
+ *  from before the colour, and their lines are written back afterwards.
+ *
+ * @param depth_idx index of depth
+ */
+void FASMultigrid::_lineJacobianSweep(idx_t depth_idx)
+{
+  idx_t axis = _lineAxis(depth_idx);
+  idx_t n[3] = { nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx] };
+  // directions perpendicular to lines
+  idx_t pa = (axis == 1) ? 1 : 0, pb = (axis == 3) ? 1 : 2;
+  idx_t na = n[pa], nb = n[pb];
+
+  idx_t c = tapes[depth_idx].radius + 1;
+  bool mixed = tapes[depth_idx].mixed;
+
+  if(na % c != 0 || nb % c != 0)
+  {
+    std::vector<real_t> work;
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      for(idx_t line = 0; line < na * nb; line++)
+        _lineJacobianSolve(depth_idx, axis, eqn_id, line / nb, line % nb, work);
+    return;
+  }
+
+  // equations relaxed together per colour
+  idx_t n_colours = mixed ? c*c : c;
+  idx_t group = concurrent_equations ? u_n : 1;
+  idx_t pts = n[0] * n[1] * n[2];
+  real_t * out = NULL;
+  if(concurrent_equations)
+  {
+    if((idx_t) temporal_scratch.size() < u_n * pts)
+      temporal_scratch.resize(u_n * pts);
+    out = &temporal_scratch[0];
+  }
+
+  for(idx_t colour = 0; colour < n_colours; colour++)
+    for(idx_t eqn_0 = 0; eqn_0 < u_n; eqn_0 += group)
+    {
+      #pragma omp parallel default(shared)
+      {
+        std::vector<real_t> work;
+        #pragma omp for
+        for(idx_t task = 0; task < group * na * nb; task++)
+        {
+          idx_t eqn_id = eqn_0 + task / (na * nb), line = task % (na * nb);
+          idx_t a = line / nb, b = line % nb;
+          idx_t line_colour = mixed ? (a % c) * c + (b % c) : (a + b) % c;
+          if(line_colour == colour)
+            _lineJacobianSolve(depth_idx, axis, eqn_id, a, b, work,
+              (out != NULL) ? out + eqn_id * pts : NULL);
+        }
+
+        if(out != NULL)
+        {
+          #pragma omp for
+          for(idx_t task = 0; task < group * na * nb; task++)
+          {
+            idx_t eqn_id = eqn_0 + task / (na * nb), line = task % (na * nb);
+            idx_t a = line / nb, b = line % nb;
+            idx_t line_colour = mixed ? (a % c) * c + (b % c) : (a + b) % c;
+            if(line_colour != colour)
+              continue;
+            fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+            for(idx_t l = 0; l < n[axis-1]; l++)
+            {
+              idx_t i = (axis == 1) ? l : a, j = (axis == 2) ? l : ((axis == 1) ? a : b),
+                k = (axis == 3) ? l : b;
+              idx_t idx = H_INDEX(i, j, k, n[0], n[1], n[2]);
+              damping_v[idx] = out[eqn_id * pts + idx];
+            }
+          }
+        }
+      }
+    }
+}
+
+/**
+ * @brief relax with inexact Newton steps whose Jacobian equation is
+ *  solved by line relaxation
+ * @details stores Jacobians at every depth regardless of the
+ *  linearization memory budget
+ *
+ * @param axis direction of lines (1, 2 or 3), or 0 for the direction of
+ *  smallest grid spacing at each depth
  */
-void FASMultigrid::_shiftGridVals(fas_grid_t & grid, real_t shift)
+void FASMultigrid::setLineRelaxation(idx_t axis)
 {
-  #pragma omp parallel for
-  for(idx_t i = 0; i < grid.pts; i++)
-    grid[i] += shift;
+  if(axis < 0 || axis > 3)
+  {
+    std::cout << "Invalid line relaxation axis " << axis << ".\n";
+    throw -1;
+  }
+  relax_scheme = line_relaxation;
+  line_axis = axis;
+  if(tapes_compiled)
+    _planLinearizationStorage();
 }
 
 /**
- * @brief "restrict" a fine grid to coarser grid
- * @details Restriction scheme:
- *  (1 given cell)*(1/8) + (6 adjacent "faces") * (1/16)
- *  + (12 adjacent "edges") * (1/32) + (8 adjacent "corners") * (1/64)
- * 
- * @param field_heirarchy field to restrict
- * @param fine_depth "depth" of finer grid
+ * @brief perform Jacobian relaxation until a desired precision is reached
+ * @details can be controled to use constrait or not, 
+ * @param depth
+ * @param norm of F(u)
+ * @param parameter can control the converge speed
+ * @param parameter can control the converge speed
+ *
  */
-void FASMultigrid::_restrictFine2coarse(fas_heirarchy_t grid_heirarchy, idx_t fine_depth)
+bool FASMultigrid::_jacobianRelax( idx_t depth, real_t norm, real_t C, idx_t p)
 {
-  idx_t fine_idx = _dIdx(fine_depth);
-  idx_t coarse_idx = fine_idx - 1;
+  idx_t i, j, k;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx], cnt = 0;
+
+  real_t   norm_r = 1e100,    norm_pre;
 
-  idx_t n_fine_x = grid_heirarchy[fine_idx].nx,
-        n_fine_y = grid_heirarchy[fine_idx].ny,
-        n_fine_z = grid_heirarchy[fine_idx].nz;
-  idx_t n_coarse_x = n_fine_x / 2, n_coarse_y = n_fine_y / 2, n_coarse_z = n_fine_z / 2 ;
+  // relax_scheme may have been set directly; plan once for a new scheme.
+  // Depths that cannot store Jacobians fall back to Jacobi sweeps.
+  if((relax_scheme == line_relaxation) != linearization_lines)
+    _planLinearizationStorage();
 
-  fas_grid_t & fine_grid = grid_heirarchy[fine_idx];
-  fas_grid_t & coarse_grid = grid_heirarchy[coarse_idx];
-  idx_t i, j, k; // coarse grid iterator
-  idx_t fi, fj, fk; // fine grid indexes
+  // u does not change until the Jacobian equation is solved
+  bool frozen = _freezeLinearization(depth_idx);
 
+  //initilizing value of damping_v
   #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i, j, k, n_coarse_x, n_coarse_y, n_coarse_z)
-  {
-    fi = i*2;
-    fj = j*2;
-    fk = k*2;
-
-    coarse_grid[H_INDEX(i,j,k,n_coarse_x, n_coarse_y, n_coarse_z)] =
-      0.125 * fine_grid[H_INDEX(fi,fj,fk,n_fine_x, n_fine_y, n_fine_z)]
-      + 0.0625 * (
-        fine_grid[H_INDEX(fi+1,fj,fk,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi,fj+1,fk,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi,fj,fk+1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi-1,fj,fk,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi,fj-1,fk,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi,fj,fk-1,n_fine_x, n_fine_y, n_fine_z)]
-      ) + 0.03125 * (
-        fine_grid[H_INDEX(fi+1,fj+1,fk,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi+1,fj-1,fk,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi-1,fj+1,fk,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi-1,fj-1,fk,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi+1,fj,fk+1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi+1,fj,fk-1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi-1,fj,fk+1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi-1,fj,fk-1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi,fj+1,fk+1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi,fj+1,fk-1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi,fj-1,fk+1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi,fj-1,fk-1,n_fine_x, n_fine_y, n_fine_z)]
-      ) + 0.015625 * (
-        fine_grid[H_INDEX(fi+1,fj+1,fk+1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi+1,fj+1,fk-1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi+1,fj-1,fk+1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi-1,fj+1,fk+1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi+1,fj-1,fk-1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi-1,fj+1,fk-1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi-1,fj-1,fk+1,n_fine_x, n_fine_y, n_fine_z)] +
-        fine_grid[H_INDEX(fi-1,fj-1,fk-1,n_fine_x, n_fine_y, n_fine_z)]
-      );
-
-  } // end loop
-
-}
-
-/**
- * @brief interpolate a coarse grid to a finer grid
- * @details using a lot of "if" before updating to deal with the boundary probs when
- * n_coarse * 2 != n_fine 
+  FAS_TILED_LOOP3(i, j, k, tilings[depth_idx])
+  {
+    for(idx_t eqn_id =0; eqn_id < u_n; eqn_id++)
+      damping_v_h[eqn_id][depth_idx][H_INDEX(i,j,k,nx, ny, nz)] = 0.0;
+  }
+  
+  while( norm_r >= std::min(pow(norm, (real_t)(p+1)) * C, norm)) 
+  {
+    //relax until the convergent condition got satisfy 
+    norm_r = 0.0;
+    norm_pre = 0.0;
+
+    if(frozen && relax_scheme == line_relaxation)
+    {
+      _lineJacobianSweep(depth_idx);
+      cnt++;
+    }
+    else
+    {
+      _jacobiSweeps(depth_idx, frozen, jacobi_fused_sweeps);
+      cnt += jacobi_fused_sweeps;
+    }
+    
+    norm_r = fas_reduce_residuals(u_n, tilings[depth_idx],
+      [&](idx_t eqn_id, idx_t i, idx_t j, idx_t k, idx_t idx) {
+        return _evaluateJacobianProductPt(eqn_id, depth_idx, i, j, k, frozen)
+          - jac_rhs_h[eqn_id][depth_idx][idx];
+      }).sum_sq;
+
+    if(cnt > 500 && norm_r > norm_pre) 
+    {
+      //cannot solve Jacobian equation to precision needed
+      std::cout << "Unable to achieve a precise enough solution within "
+                << cnt << " iterations.\n";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief apply Jacobian of all equations to a vector
+ * @details w is copied into damping_v; vectors hold all equations,
+ *  equation eqn_id at offset eqn_id * (points at depth)
+ *
+ * @param depth_idx index of depth
+ * @param w vector to apply Jacobian to
+ * @param jw result, J w
+ * @param frozen whether the Jacobian at this depth is stored
  */
-void FASMultigrid::_interpolateCoarse2fine(fas_heirarchy_t grid_heirarchy, idx_t coarse_depth)
+void FASMultigrid::_applyJacobian(idx_t depth_idx, const real_t * w,
+  real_t * jw, bool frozen)
 {
-  idx_t fine_idx = _dIdx(coarse_depth +1);
-  idx_t coarse_idx = _dIdx(coarse_depth);
-
-  idx_t n_coarse_x = nx_h[coarse_idx],
-    n_coarse_y = ny_h[coarse_idx],
-    n_coarse_z = nz_h[coarse_idx];
-  idx_t n_fine_x = n_coarse_x *2, n_fine_y = n_coarse_y * 2, n_fine_z = n_coarse_z *2;
+  idx_t eqn_id, i, j, k;
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  idx_t pts = nx * ny * nz;
 
-  fas_grid_t & coarse_grid = grid_heirarchy[coarse_idx];
-  fas_grid_t & fine_grid = grid_heirarchy[fine_idx];
-  idx_t i, j, k;
-  idx_t fi, fj, fk;
+  #pragma omp parallel for collapse(2)
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    for(idx_t idx = 0; idx < pts; idx++)
+      damping_v_h[eqn_id][depth_idx][idx] = w[eqn_id*pts + idx];
 
-  _zeroGrid(fine_grid);
+  bool padded = !frozen && _beginPaddedSweep(depth_idx, true);
 
-  
-  #pragma omp parallel for private(i, j, k, fi, fj, fk)
-  FAS_LOOP3_N(i, j, k, n_coarse_x, n_coarse_y, n_coarse_z)
-  {
-    fi = i*2;
-    fj = j*2;
-    fk = k*2;
-
-    real_t coarse_grid_val = coarse_grid[H_INDEX(i,j,k,n_coarse_x, n_coarse_y, n_coarse_z)];
-    // loop over adjacent cells.
-    for(idx_t  i_adj = -1; i_adj <= 1; ++i_adj )
-      for(idx_t  j_adj = -1; j_adj <= 1; ++j_adj )
-        for(idx_t  k_adj = -1; k_adj <= 1; ++k_adj )
-        {
-          idx_t fine_grid_loc = H_INDEX(fi + i_adj, fj + j_adj, fk + k_adj,
-            n_fine_x, n_fine_y, n_fine_z);
-          idx_t coarse_grid_loc = H_INDEX(fi + i_adj, fj + j_adj, fk + k_adj,
-            n_coarse_x*2, n_coarse_y*2, n_coarse_z*2);
-
-          if(i_adj == 0 && j_adj == 0 && k_adj == 0)
-          {            
-            #pragma omp atomic
-            fine_grid[fine_grid_loc] += coarse_grid_val;
-          }
-          else if(fine_grid_loc == coarse_grid_loc)
-          {
-            real_t divisor = std::pow( 2.0,
-              std::abs(i_adj) + std::abs(j_adj) + std::abs(k_adj) );
-            #pragma omp atomic
-            fine_grid[fine_grid_loc] += coarse_grid_val/divisor;
-          }
-        } // end for loop
+  #pragma omp parallel for default(shared) private(eqn_id,i,j,k)
+  FAS_EQN_TILED_LOOP3(eqn_id, i, j, k, u_n, tilings[depth_idx])
+  {
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+    jw[eqn_id*pts + idx] = _evaluateJacobianProductPt(eqn_id, depth_idx, i, j, k, frozen);
   }
 
+  if(padded)
+    _endPaddedSweep(depth_idx);
 }
 
 /**
- * @brief      Evaluate elliptic equation, stores in an array
- * 
- * @param      result_h  grid to store result on
- * @param      eqn_id    id of equation to deal with
- * @param[in]  depth     depth to evaluate at
+ * @brief linear multigrid cycle for J v = jac_rhs, improving damping_v
+ * @details the Jacobian is rediscretized on coarser grids around the
+ *  restricted u; uses tmp_h at depth and below for residuals and
+ *  corrections, so it may only be used at the finest depth; tmp_h at
+ *  the finest depth is allocated on first use
+ *
+ * @param depth depth of cycle
+ * @param frozen whether the Jacobian is stored, indexed by depth index
  */
-void FASMultigrid::_evaluateEllipticEquation(fas_heirarchy_t result_h, idx_t eqn_id, idx_t depth)
+void FASMultigrid::_linearCorrectionCycle(idx_t depth, const std::vector<bool> & frozen)
 {
   idx_t i, j, k;
   idx_t depth_idx = _dIdx(depth);
+
+  if(depth == min_depth)
+  {
+    _jacobiSweeps(depth_idx, frozen[depth_idx], newton_coarse_sweeps);
+    return;
+  }
+
   idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  idx_t coarse_idx = depth_idx - 1;
+  idx_t cnx = nx_h[coarse_idx], cny = ny_h[coarse_idx], cnz = nz_h[coarse_idx];
 
-  fas_grid_t & result = result_h[depth_idx];
+  _jacobiSweeps(depth_idx, frozen[depth_idx], newton_smooth_sweeps);
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i, j, k, nx, ny, nz)
+  // restrict residual of linear equation
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
   {
-    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
-    result[idx] = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k); 
+    fas_grid_t & tmp = tmp_h[eqn_id][depth_idx];
+    if(tmp.pts == 0)
+      tmp.init(nx, ny, nz);
+    fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
+    #pragma omp parallel for default(shared) private(i,j,k)
+    FAS_TILED_LOOP3(i, j, k, tilings[depth_idx])
+    {
+      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      tmp[idx] = jac_rhs[idx]
+        - _evaluateJacobianProductPt(eqn_id, depth_idx, i, j, k, frozen[depth_idx]);
+    }
+    _restrictFine2coarse(tmp_h[eqn_id], depth);
+
+    fas_grid_t & coarse_tmp = tmp_h[eqn_id][coarse_idx];
+    fas_grid_t & coarse_rhs = jac_rhs_h[eqn_id][coarse_idx];
+    fas_grid_t & coarse_v = damping_v_h[eqn_id][coarse_idx];
+    #pragma omp parallel for default(shared) private(i,j,k)
+    FAS_TILED_LOOP3(i, j, k, tilings[coarse_idx])
+    {
+      idx_t idx = H_INDEX(i, j, k, cnx, cny, cnz);
+      coarse_rhs[idx] = coarse_tmp[idx];
+      coarse_v[idx] = 0.0;
+    }
+  }
+
+  _linearCorrectionCycle(depth - 1, frozen);
+
+  // add interpolated correction
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    _copyGrid(damping_v_h, tmp_h, eqn_id, depth - 1);
+    _interpolateCoarse2fine(tmp_h[eqn_id], depth - 1);
+
+    fas_grid_t & tmp = tmp_h[eqn_id][depth_idx];
+    fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+    #pragma omp parallel for default(shared) private(i,j,k)
+    FAS_TILED_LOOP3(i, j, k, tilings[depth_idx])
+    {
+      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      damping_v[idx] += tmp[idx];
+    }
   }
+
+  _jacobiSweeps(depth_idx, frozen[depth_idx], newton_smooth_sweeps);
 }
 
-  
 /**
- * @brief      Computes residual, stores result in "tmp" heirarchy
- * @param      residual_h  grid to store result on
- * @param      eqn_id    id of equation to deal with
- * @param[in]  depth     depth to evaluate at
+ * @brief approximately solve J z = r
+ * @details linear multigrid cycles on the finest depth, Jacobi sweeps
+ *  elsewhere
+ *
+ * @param depth depth of equation
+ * @param r right hand side
+ * @param z approximate solution
+ * @param frozen whether the Jacobian is stored, indexed by depth index
  */
-void FASMultigrid::_computeResidual(fas_heirarchy_t residual_h, idx_t eqn_id, idx_t depth)
+void FASMultigrid::_applyNewtonPreconditioner(idx_t depth, const real_t * r,
+  real_t * z, const std::vector<bool> & frozen)
 {
-  idx_t i, j, k;
   idx_t depth_idx = _dIdx(depth);
-  idx_t nx = residual_h[depth_idx].nx, ny = residual_h[depth_idx].ny, nz = residual_h[depth_idx].nz;
+  idx_t pts = nx_h[depth_idx] * ny_h[depth_idx] * nz_h[depth_idx];
 
-  fas_grid_t & coarse_src = coarse_src_h[eqn_id][depth_idx];
-  fas_grid_t & residual = residual_h[depth_idx];
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
+    fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+    #pragma omp parallel for
+    for(idx_t idx = 0; idx < pts; idx++)
+    {
+      jac_rhs[idx] = r[eqn_id*pts + idx];
+      damping_v[idx] = 0.0;
+    }
+  }
 
-  _evaluateEllipticEquation(residual_h, eqn_id, depth);
+  if(depth == max_depth && depth > min_depth && newton_precond_cycles > 0)
+    for(idx_t c = 0; c < newton_precond_cycles; c++)
+      _linearCorrectionCycle(depth, frozen);
+  else
+    _jacobiSweeps(depth_idx, frozen[depth_idx], newton_coarse_sweeps);
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i,j,k,nx,ny,nz)
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
   {
-    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
-    residual[idx] = coarse_src[idx] - residual[idx];
+    fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+    #pragma omp parallel for
+    for(idx_t idx = 0; idx < pts; idx++)
+      z[eqn_id*pts + idx] = damping_v[idx];
   }
 }
 
 /**
- * @brief      Computes max residual for a equation
- * @param      eqn_id id of equation we deal with
- * @param[in]  depth  depth to compute residual at
- * @return residual
+ * @brief solve J x = b with right preconditioned, restarted flexible GMRES
+ * @details Jacobian products are matrix-free; the preconditioner
+ *  contains Jacobi sweeps and so varies slightly between applications
+ *  when run in parallel, hence the flexible variant
+ *
+ * @param depth depth of equation
+ * @param b right hand side
+ * @param x solution, initially zero
+ * @param tol absolute tolerance on |b - J x|
+ * @param frozen whether the Jacobian is stored, indexed by depth index
+ * @return whether tolerance was reached
  */
-real_t FASMultigrid::_getMaxResidual(idx_t eqn_id, idx_t depth)
+bool FASMultigrid::_solveJacobianGMRES(idx_t depth, const std::vector<real_t> & b,
+  std::vector<real_t> & x, real_t tol, const std::vector<bool> & frozen)
 {
-  idx_t i, j, k;
   idx_t depth_idx = _dIdx(depth);
-  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
-  fas_grid_t & coarse_src = coarse_src_h[eqn_id][depth_idx];
+  idx_t n = b.size(), m = newton_krylov_dim;
 
-  real_t max_residual = 0.0;
+  std::vector< std::vector<real_t> > V(m + 1, std::vector<real_t>(n)),
+    Z(m, std::vector<real_t>(n));
+  std::vector<real_t> H((m + 1) * m), cs(m), sn(m), g(m + 1), y(m), w(n);
 
-  #pragma omp parallel for default(shared) private(j,k)
-  FAS_LOOP3_N(i,j,k,nx,ny,nz)
+  for(idx_t restart = 0; restart < newton_max_restarts; restart++)
   {
-    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
-    real_t current_residual = std::fabs(coarse_src[idx]
-          - _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k));
-      
-    #pragma omp critical
+    // r = b - J x
+    if(restart == 0)
+      V[0] = b;
+    else
     {
-      if(current_residual > max_residual)
-        max_residual = current_residual;
+      _applyJacobian(depth_idx, &x[0], &w[0], frozen[depth_idx]);
+      #pragma omp parallel for
+      for(idx_t l = 0; l < n; l++)
+        V[0][l] = b[l] - w[l];
     }
+
+    real_t beta = std::sqrt(fas_dot(V[0], V[0]));
+    if(beta <= tol)
+      return true;
+
+    fas_scale(V[0], 1.0 / beta);
+    std::fill(g.begin(), g.end(), 0.0);
+    g[0] = beta;
+
+    idx_t jn = 0;
+    for(idx_t jc = 0; jc < m; jc++)
+    {
+      _applyNewtonPreconditioner(depth, &V[jc][0], &Z[jc][0], frozen);
+      _applyJacobian(depth_idx, &Z[jc][0], &w[0], frozen[depth_idx]);
+
+      // modified Gram-Schmidt
+      for(idx_t ic = 0; ic <= jc; ic++)
+      {
+        H[ic*m + jc] = fas_dot(w, V[ic]);
+        fas_axpy(w, -H[ic*m + jc], V[ic]);
+      }
+      H[(jc+1)*m + jc] = std::sqrt(fas_dot(w, w));
+      if(H[(jc+1)*m + jc] > 0.0)
+      {
+        V[jc+1] = w;
+        fas_scale(V[jc+1], 1.0 / H[(jc+1)*m + jc]);
+      }
+
+      // Givens rotations keep H upper triangular
+      for(idx_t ic = 0; ic < jc; ic++)
+      {
+        real_t h0 = H[ic*m + jc], h1 = H[(ic+1)*m + jc];
+        H[ic*m + jc] = cs[ic] * h0 + sn[ic] * h1;
+        H[(ic+1)*m + jc] = -sn[ic] * h0 + cs[ic] * h1;
+      }
+      real_t h0 = H[jc*m + jc], h1 = H[(jc+1)*m + jc];
+      real_t rr = std::sqrt(h0*h0 + h1*h1);
+      cs[jc] = (rr > 0.0) ? h0 / rr : 1.0;
+      sn[jc] = (rr > 0.0) ? h1 / rr : 0.0;
+      H[jc*m + jc] = rr;
+      H[(jc+1)*m + jc] = 0.0;
+      g[jc+1] = -sn[jc] * g[jc];
+      g[jc] = cs[jc] * g[jc];
+
+      jn = jc + 1;
+      if(std::fabs(g[jc+1]) <= tol || h1 == 0.0)
+        break;
+    }
+
+    // x += Z y, with H y = g
+    for(idx_t ic = jn - 1; ic >= 0; ic--)
+    {
+      y[ic] = g[ic];
+      for(idx_t kc = ic + 1; kc < jn; kc++)
+        y[ic] -= H[ic*m + kc] * y[kc];
+      y[ic] = (H[ic*m + ic] != 0.0) ? y[ic] / H[ic*m + ic] : 0.0;
+    }
+    for(idx_t ic = 0; ic < jn; ic++)
+      fas_axpy(x, y[ic], Z[ic]);
+
+    if(std::fabs(g[jn]) <= tol)
+      return true;
   }
 
-  return max_residual;
+  return false;
 }
 
 /**
- * @brief get maximum residual among all equations
+ * @brief single Jacobian-free Newton-Krylov step, u += \lambda v
+ * @details J v = -(F(u) - coarse_src) is solved with GMRES to a
+ *  relative tolerance of min(newton_forcing, |F(u) - coarse_src|),
+ *  which gives quadratic convergence close to the solution
  *
- * @param depth to perform calculation
- * @return residual 
- */  
-real_t FASMultigrid::_getMaxResidualAllEqs(idx_t depth)
+ * @param depth depth to relax
+ * @return whether a step was taken
+ */
+bool FASMultigrid::_newtonKrylovStep(idx_t depth)
 {
-  real_t max_for_all = 0;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  idx_t pts = nx * ny * nz;
+
+  std::vector<real_t> b(u_n * pts), x(u_n * pts, 0.0);
+  bool padded = _beginPaddedSweep(depth_idx, false);
+  real_t norm = fas_reduce_residuals(u_n, tilings[depth_idx],
+    [&](idx_t eqn_id, idx_t i, idx_t j, idx_t k, idx_t idx) {
+      real_t temp = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k)
+        - coarse_src_h[eqn_id][depth_idx][idx];
+      b[eqn_id*pts + idx] = -temp;
+      return temp;
+    }).sum_sq;
+  if(padded)
+    _endPaddedSweep(depth_idx);
+
+  // Jacobian at current u, and on coarser grids for the preconditioner
+  std::vector<bool> frozen(total_depths, false);
+  frozen[depth_idx] = _freezeLinearization(depth_idx);
+  if(depth == max_depth && newton_precond_cycles > 0)
+  {
+    for(idx_t d = depth; d > min_depth; --d)
+    {
+      for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+        _restrictFine2coarse(u_h[eqn_id], d);
+      frozen[_dIdx(d-1)] = _freezeLinearization(_dIdx(d-1));
+    }
+  }
+
+  real_t norm_F = std::sqrt(norm);
+  if(!_solveJacobianGMRES(depth, b, x, std::min(newton_forcing, norm_F) * norm_F, frozen))
+    std::cout << "  GMRES did not reach requested tolerance.\n";
+
   for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
   {
-    max_for_all = std::max(max_for_all, _getMaxResidual(eqn_id, depth));
+    fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+    #pragma omp parallel for
+    for(idx_t idx = 0; idx < pts; idx++)
+      damping_v[idx] = x[eqn_id*pts + idx];
   }
-  return max_for_all;
+
+  return _getLambda(depth, norm);
 }
 
+/**
+ * @brief set parameters of the newton relaxation scheme
+ *
+ * @param krylov_dim number of GMRES iterations before restarting
+ * @param max_restarts maximum number of GMRES restarts
+ * @param precond_cycles linear multigrid cycles preconditioning the
+ *  finest depth; 0 to use Jacobi sweeps
+ */
+void FASMultigrid::setNewtonKrylovParameters(idx_t krylov_dim,
+  idx_t max_restarts, idx_t precond_cycles)
+{
+  newton_krylov_dim = krylov_dim;
+  newton_max_restarts = max_restarts;
+  newton_precond_cycles = precond_cycles;
+}
 
 /**
- * @brief      Compute coarse_src and u on a coarser grid
- * using tmp_h for some computations
- * @param id of equation
- * @param[in]  fine_depth  depth of grid to coarsen
+ * @brief relax u using the inexact Newton iterative method
+ * @param depth
+ * @param max interation number
+ * @param initial_residual norms of residual at u if already in jac_rhs
+ *  (see _evaluateRelaxResidual()), or NULL
  */
-void FASMultigrid::_computeCoarseRestrictions(idx_t eqn_id, idx_t fine_depth)
+void FASMultigrid::_relaxSolution_GaussSeidel( idx_t depth, idx_t max_iterations,
+  const fas_residual_norms * initial_residual)
 {
-  idx_t i, j, k;
+  idx_t s;
+  idx_t depth_idx = _dIdx(depth);
+  fas_residual_norms residual;      // residual at u, -residual is in jac_rhs
+  bool residual_current = (initial_residual != NULL);
+  if(residual_current)
+    residual = *initial_residual;
+
+  for(s=0; s<max_iterations; ++s)
+  {
+    
+    // move this precision condition to the beginning in case
+    // perfect initial geuss causes infinite number of
+    // iterations for function: _jacobianRelax()
+    if(!residual_current)
+      residual = _evaluateRelaxResidual(depth_idx);
+    residual_current = false;
+
+    // set tolenrance precision, which should be smaller when grids become more coarse
+    if(residual.max_abs < (relaxation_tolerance / pw2(1<<(max_depth_idx - depth_idx)) )) 
+      break;
+
+    if(relax_scheme == nonlinear_gauss_seidel)
+    {
+      _nonlinearGaussSeidelSweep(depth);
+    }
+    else if(relax_scheme == newton)
+    {
+      if(_newtonKrylovStep(depth) == false)
+      {
+        std::cout<<"Can't fine suitable damping factor!!!\n";
+        throw -1;
+      }
+    }
+    else if(relax_scheme == inexact_newton
+        || relax_scheme == inexact_newton_constrained
+        || relax_scheme == line_relaxation)
+    {
+      if( _jacobianRelax(depth, residual.sum_sq, 1, 0) == false)
+      {
+        break;
+      }
+      
+      // get damping parameter lambda
+      if(_getLambda(depth, residual.sum_sq) == false)
+      {
+        std::cout<<"Can't fine suitable damping factor!!!\n";
+        throw -1;
+      }
 
-  _restrictFine2coarse(u_h[eqn_id], fine_depth);
+      // the line search usually leaves the residual at the new u behind
+      if(last_line_search.residual_stored)
+      {
+        residual.max_abs = last_line_search.max_residual;
+        residual.sum_sq = last_line_search.norm;
+        residual_current = true;
+      }
+    }
 
-  _computeResidual(tmp_h[eqn_id], eqn_id, fine_depth);
+  } // end iterations loop
 
-  _restrictFine2coarse(tmp_h[eqn_id], fine_depth);
+}
 
-  _evaluateEllipticEquation(coarse_src_h[eqn_id], eqn_id, fine_depth - 1);
 
-  idx_t coarse_idx = _dIdx(fine_depth -1);
+/**
+ * @brief solve a dense linear system by Gaussian elimination with
+ *  partial pivoting
+ *
+ * @param n number of unknowns
+ * @param a row-major n x n matrix, overwritten
+ * @param b right hand side, overwritten by the solution
+ * @return false if the matrix is numerically singular
+ */
+static bool fas_dense_lu_solve(idx_t n, std::vector<real_t> & a, std::vector<real_t> & b)
+{
+  real_t scale = 0.0;
+  for(idx_t l = 0; l < n * n; l++)
+    scale = std::max(scale, std::fabs(a[l]));
 
-  idx_t nx = nx_h[coarse_idx], ny = ny_h[coarse_idx], nz = nz_h[coarse_idx];
+  for(idx_t c = 0; c < n; c++)
+  {
+    idx_t p = c;
+    for(idx_t r = c + 1; r < n; r++)
+      if(std::fabs(a[r*n + c]) > std::fabs(a[p*n + c]))
+        p = r;
+    if(!(std::fabs(a[p*n + c]) > 1e-10 * scale))
+      return false;
+    if(p != c)
+    {
+      for(idx_t q = c; q < n; q++)
+        std::swap(a[p*n + q], a[c*n + q]);
+      std::swap(b[p], b[c]);
+    }
 
-  fas_grid_t & coarse_src = coarse_src_h[eqn_id][coarse_idx];
-  fas_grid_t & tmp = tmp_h[eqn_id][coarse_idx];
+    real_t inv_pivot = 1.0 / a[c*n + c];
+    #pragma omp parallel for
+    for(idx_t r = c + 1; r < n; r++)
+    {
+      real_t f = a[r*n + c] * inv_pivot;
+      if(f == 0.0)
+        continue;
+      for(idx_t q = c + 1; q < n; q++)
+        a[r*n + q] -= f * a[c*n + q];
+      b[r] -= f * b[c];
+    }
+  }
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i,j,k,nx,ny,nz)
+  for(idx_t r = n - 1; r >= 0; r--)
   {
-    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
-    coarse_src[idx] += tmp[idx];
+    real_t sum = b[r];
+    for(idx_t q = r + 1; q < n; q++)
+      sum -= a[r*n + q] * b[q];
+    b[r] = sum / a[r*n + r];
   }
+
+  return true;
 }
 
 /**
- * @brief      Convert a grid containing an approximate solution
- *  to a grid containing the solution error, err = true - appx.
+ * @brief single Newton step, u += \lambda v, with J v = -(F(u) - coarse_src)
+ *  solved exactly
+ * @details the dense Jacobian is assembled column by column by applying
+ *  it to unit vectors, so this is only meant for the coarsest depth
  *
- * @param      appx_to_err_h  grid heirarchy containing appx'n to convert
- * @param      exact_soln_h   heirarchy containing exact solution
- * @param[in]  depth          depth to perform computation at
- */  
-void FASMultigrid::_changeApproximateSolutionToError(fas_heirarchy_t  appx_to_err_h,
-    fas_heirarchy_t  exact_soln_h, idx_t depth)
+ * @param depth depth to relax
+ * @return whether a step was taken; false if the Jacobian is singular
+ *  or no damping factor was found
+ */
+bool FASMultigrid::_directNewtonStep(idx_t depth)
 {
-  idx_t i, j, k;
-
   idx_t depth_idx = _dIdx(depth);
   idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  idx_t pts = nx * ny * nz, n = u_n * pts;
+
+  std::vector<real_t> b(n), jac(n * n), w(n, 0.0), col(n);
+  bool padded = _beginPaddedSweep(depth_idx, false);
+  real_t norm = fas_reduce_residuals(u_n, tilings[depth_idx],
+    [&](idx_t eqn_id, idx_t i, idx_t j, idx_t k, idx_t idx) {
+      real_t temp = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k)
+        - coarse_src_h[eqn_id][depth_idx][idx];
+      b[eqn_id*pts + idx] = -temp;
+      return temp;
+    }).sum_sq;
+  if(padded)
+    _endPaddedSweep(depth_idx);
+
+  bool frozen = _freezeLinearization(depth_idx);
+  for(idx_t c = 0; c < n; c++)
+  {
+    w[c] = 1.0;
+    _applyJacobian(depth_idx, &w[0], &col[0], frozen);
+    w[c] = 0.0;
+    for(idx_t r = 0; r < n; r++)
+      jac[r*n + c] = col[r];
+  }
 
-  fas_grid_t & appx_to_err = appx_to_err_h[depth_idx];
-  fas_grid_t & exact_soln = exact_soln_h[depth_idx];
+  if(!fas_dense_lu_solve(n, jac, b))
+    return false;
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i,j,k,nx,ny,nz)
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
   {
-    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
-    appx_to_err[idx] = exact_soln[idx] - appx_to_err[idx];
+    fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+    for(idx_t idx = 0; idx < pts; idx++)
+      damping_v[idx] = b[eqn_id*pts + idx];
   }
+
+  return _getLambda(depth, norm);
 }
 
 /**
- * @brief Compute and add in correction to fine grid from error
- * on coarser grid; replace error with appx. solution
- * 
- * @param err_h grid heirarchy containing error
- * @param err2appx_h heirarchy containing approximate solution
- * @param fine_depth depth of fine grid to correct
+ * @brief solve on the coarsest depth
+ * @details With coarse_direct, Newton steps with a dense solve of the
+ *  Jacobian equation are taken until the residual is below the
+ *  relaxation tolerance, which takes a handful of steps. Systems with
+ *  more than coarse_direct_max_unknowns unknowns, singular Jacobians
+ *  (e.g. a periodic Laplacian alone) and failed line searches fall back
+ *  to relaxation.
+ *
+ * @param depth coarsest depth
+ * @param max_iterations relaxation iterations when not solving directly
  */
-void FASMultigrid::_correctFineFromCoarseErr_Err2Appx(fas_heirarchy_t err2appx_h,
-          fas_heirarchy_t  appx_soln_h, idx_t fine_depth)
+void FASMultigrid::_solveCoarsest(idx_t depth, idx_t max_iterations)
 {
-  idx_t i, j, k;
-  idx_t coarse_depth = fine_depth-1;
-
-  idx_t fine_depth_idx = _dIdx(fine_depth);
-
-  idx_t n_fine_x = nx_h[fine_depth_idx], n_fine_y = ny_h[fine_depth_idx], n_fine_z = nz_h[fine_depth_idx];
-  _interpolateCoarse2fine(err2appx_h, coarse_depth);
-
-  fas_grid_t & err2appx = err2appx_h[fine_depth_idx];
-  fas_grid_t & appx_soln = appx_soln_h[fine_depth_idx];
+  idx_t depth_idx = _dIdx(depth);
+  idx_t unknowns = u_n * nx_h[depth_idx] * ny_h[depth_idx] * nz_h[depth_idx];
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i,j,k, n_fine_x, n_fine_y, n_fine_z)
+  if(coarse_solver == coarse_direct && unknowns <= coarse_direct_max_unknowns)
   {
-    idx_t idx = H_INDEX(i, j, k, n_fine_x,n_fine_y,n_fine_z);
-    // appx. solution in intermediate variable
-    real_t appx_val = appx_soln[idx];
-    // correct approximate solution with error
-    appx_soln[idx] += err2appx[idx];
-    // store approximate solution in err2appx
-    err2appx[idx] = appx_val;
+    real_t tolerance = relaxation_tolerance / pw2(1<<(max_depth_idx - depth_idx));
+    for(idx_t s = 0; s < coarse_newton_iters; s++)
+    {
+      if(_getMaxResidualAllEqs(depth) < tolerance)
+        return;
+      if(!_directNewtonStep(depth))
+        break;
+    }
   }
+
+  _relaxSolution_GaussSeidel(depth, max_iterations);
 }
 
 /**
- * @brief Copy grid from one heirarchy to another
- * 
- * @param from_h copy from this heirarchy
- * @param to_h to this heirarchy
- * @param depth at this depth
+ * @brief select solver used on the coarsest depth
+ *
+ * @param type solver (see coarse_solver_t)
+ * @param max_unknowns largest number of unknowns (points times
+ *  equations) solved directly
  */
-void FASMultigrid::_copyGrid(fas_heirarchy_t from_h[], fas_heirarchy_t to_h[], idx_t eqn_id, idx_t depth)
+void FASMultigrid::setCoarseSolver(coarse_solver_t type, idx_t max_unknowns)
 {
-  idx_t depth_idx = _dIdx(depth);
-  fas_grid_t & from = from_h[eqn_id][depth_idx];
-  fas_grid_t & to = to_h[eqn_id][depth_idx];
-  to = from;
+  coarse_solver = type;
+  coarse_direct_max_unknowns = max_unknowns;
 }
 
 /**
- * @brief iterative method to find a \lambda between 1 and zero,
- *        returning the largest value that satisfies
- *        norm less than the norm of F(u)
- * @param depth
- * @param norm
+ * @brief single pointwise Newton update of u for one equation
+ * @details u_{eqn} -= (F(u) - coarse_src) / (dF/du_{eqn}) at the point
+ *
+ * @param eqn_id id of equation (and variable updated)
+ * @param depth_idx index of depth
+ * @param i x grid index
+ * @param j y grid index
+ * @param k z grid index
  */
-bool FASMultigrid::_getLambda( idx_t depth, real_t norm)
+void FASMultigrid::_nonlinearGaussSeidelPt(idx_t eqn_id, idx_t depth_idx,
+  idx_t i, idx_t j, idx_t k)
 {
-  idx_t i, j, k, s;
-  idx_t depth_idx = _dIdx(depth);
   idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
-  real_t  sum = 0.0;
-
-  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
-  {
-    fas_grid_t & u = u_h[eqn_id][depth_idx];
-    fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
-    FAS_LOOP3_N(i,j,k,nx,ny,nz)
-    {
-      idx_t idx = H_INDEX(i, j, k, nx,ny,nz);
-      u[idx] +=  1.0 * damping_v[idx] ;
-    }
-  }
-  
-  for( s = 0; s < 100; s++)
-  {
-    //lambda = 1.0 - (real_t)s * 0.01; //should always start with \lambda = 1
+  idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+  fas_grid_t & u = u_h[eqn_id][depth_idx];
 
-    sum = 0.0;
+  real_t res = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k)
+    - coarse_src_h[eqn_id][depth_idx][idx];
 
-    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
-    {
-      fas_grid_t & coarse_src = coarse_src_h[eqn_id][depth_idx];
-      #pragma omp parallel for default(shared) private(j,k) reduction(+:sum)
-      FAS_LOOP3_N(i,j,k,nx,ny,nz)
-      {
-        idx_t idx = H_INDEX(i, j, k, nx,ny,nz);
-        real_t temp = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k) - coarse_src[idx];
-        sum += temp * temp;
-      }
-      
-    }
+  // only the diagonal (coef_b) is needed
+  real_t coef_a = 0.0, coef_b = 0.0;
+  _evaluateIterationForJacEquation(eqn_id, depth_idx, coef_a, coef_b, i, j, k, eqn_id);
 
-    if(sum <= norm)  // when | F(u + \lambda v) | < | F(u) | stop
-      return 1;
+  if(coef_b != 0.0)
+    u[idx] -= res / coef_b;
+}
 
-    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+/**
+ * @brief radius of the stencils the equations at a depth read
+ * @details that of the compiled tape, or STENCIL_ORDER/2 (with mixed
+ *  derivatives) when a user supplied kernel is installed, which may use
+ *  any stencil regardless of the molecules it was built from
+ *
+ * @param depth_idx index of depth
+ * @param mixed set to whether stencils may have mixed derivatives
+ * @return radius
+ */
+idx_t FASMultigrid::_stencilRadius(idx_t depth_idx, bool & mixed)
+{
+  mixed = tapes[depth_idx].mixed;
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    if(eqn_kernels[eqn_id] != NULL && eqn_kernels[eqn_id] != jit_kernels[eqn_id])
     {
-      fas_grid_t & u = u_h[eqn_id][depth_idx];
-      #pragma omp parallel for default(shared) private(j,k)
-      FAS_LOOP3_N(i,j,k,nx,ny,nz)
-      {
-        fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
-        idx_t idx = H_INDEX(i, j, k, nx,ny,nz);
-        u[idx] -= (0.01) * damping_v[idx];
-      }
+      mixed = true;
+      return STENCIL_ORDER / 2;
     }
-  }
-  
-  return 0;
+  return tapes[depth_idx].radius;
 }
 
 /**
- * @brief perform Jacobian relaxation until a desired precision is reached
- * @details can be controled to use constrait or not, 
- * @param depth
- * @param norm of F(u)
- * @param parameter can control the converge speed
- * @param parameter can control the converge speed
+ * @brief one nonlinear Gauss-Seidel sweep, updating u in place
+ * @details Points are coloured so that no stencil couples two points of
+ *  the same colour, which lets each colour be updated in parallel:
+ *  (i+j+k) mod (R+1) for stencils along the axes, and
+ *  (i,j,k) mod (R+1) when there are mixed derivatives, for stencil
+ *  radius R (red-black and 8 colours for second order stencils).
+ *  Colourings are only consistent with the periodic wrap when every
+ *  dimension is divisible by R+1; otherwise the sweep runs serially in
+ *  lexicographic order.
  *
+ * @param depth depth to relax
  */
-bool FASMultigrid::_jacobianRelax( idx_t depth, real_t norm, real_t C, idx_t p)
+void FASMultigrid::_nonlinearGaussSeidelSweep(idx_t depth)
 {
   idx_t i, j, k;
   idx_t depth_idx = _dIdx(depth);
-  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx], cnt = 0;
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
 
-  real_t   norm_r = 1e100,    norm_pre;
+  bool mixed;
+  idx_t c = _stencilRadius(depth_idx, mixed) + 1;
 
-  //initilizing value of damping_v
-  #pragma omp parallel for default(shared) private(j,k)
-  FAS_LOOP3_N(i, j, k, nx, ny, nz)
-  {
-    for(idx_t eqn_id =0; eqn_id < u_n; eqn_id++)
-      damping_v_h[eqn_id][depth_idx][H_INDEX(i,j,k,nx, ny, nz)] = 0.0;
-  }
-  
-  while( norm_r >= std::min(pow(norm, (real_t)(p+1)) * C, norm)) 
+  if(nx % c != 0 || ny % c != 0 || nz % c != 0)
   {
-    //relax until the convergent condition got satisfy 
-    norm_r = 0.0;
-    norm_pre = 0.0;
-
-    // TODO: parallelize
     for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
-    {
-      fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
-      fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
-      #pragma omp parallel for default(shared) private(j,k)
       FAS_LOOP3_N(i,j,k,nx,ny,nz)
-      {
-        idx_t idx = H_INDEX(i,j,k,nx,ny,nz);
-        real_t coef_a =0, coef_b = 0, temp = 0;
-        _evaluateIterationForJacEquation(eqn_id, depth_idx, coef_a, coef_b, i, j, k, eqn_id);
-        for(idx_t u_id = 0; u_id < u_n; u_id++)
-        {
-          
-          if(u_id != eqn_id)
-            temp += _evaluateDerEllipticEquation(eqn_id, depth_idx, i, j, k, u_id);
-        }
-        damping_v[idx] = (coef_a - jac_rhs[idx] + temp)/ (-coef_b);
-      }      
-    }
-    
-    #pragma omp parallel for default(shared) private(i,j,k) reduction(+:norm_r)
-    FAS_LOOP3_N(i,j,k,nx,ny,nz)
+        _nonlinearGaussSeidelPt(eqn_id, depth_idx, i, j, k);
+    return;
+  }
+
+  if(mixed)
+  {
+    for(idx_t colour = 0; colour < c*c*c; colour++)
     {
-      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      idx_t ci = colour / (c*c), cj = (colour / c) % c, ck = colour % c;
       for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
       {
-        real_t temp = 0;
-        fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
-        for(idx_t u_id =0; u_id < u_n; u_id++)
-          temp += _evaluateDerEllipticEquation(eqn_id, depth_idx, i, j, k, u_id);
-        temp -= jac_rhs[idx];
-        norm_r += temp * temp;      
+        #pragma omp parallel for default(shared) private(i,j,k)
+        for(i = ci; i < nx; i += c)
+          for(j = cj; j < ny; j += c)
+            for(k = ck; k < nz; k += c)
+              _nonlinearGaussSeidelPt(eqn_id, depth_idx, i, j, k);
       }
     }
-          
-    cnt++;
-
-    if(cnt > 500 && norm_r > norm_pre) 
-    {
-      //cannot solve Jacobian equation to precision needed
-      std::cout << "Unable to achieve a precise enough solution within "
-                << cnt << " iterations.\n";
-      return false;
-    }
   }
-
-  return true;
-}
-
-/**
- * @brief relax u using the inexact Newton iterative method
- * @param depth
- * @param max interation number
- */
-void FASMultigrid::_relaxSolution_GaussSeidel( idx_t depth, idx_t max_iterations)
-{
-  idx_t i, j, k, s;
-  idx_t depth_idx = _dIdx(depth);
-  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
-  real_t   norm;
-
-  for(s=0; s<max_iterations; ++s)
+  else
   {
-    
-    // move this precision condition to the beginning in case
-    // perfect initial geuss causes infinite number of
-    // iterations for function: _jacobianRelax()
-
-    // set tolenrance precision, which should be smaller when grids become more coarse
-    if(_getMaxResidualAllEqs( depth) < (relaxation_tolerance / pw2(1<<(max_depth_idx - depth_idx)) )) 
-      break;
-
-    if(relax_scheme == inexact_newton
-        || relax_scheme == inexact_newton_constrained)
+    for(idx_t colour = 0; colour < c; colour++)
     {
-      norm = 0.0;
-      
       for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
       {
-        fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
-        fas_grid_t & coarse_src = coarse_src_h[eqn_id][depth_idx];
-        
-        #pragma omp parallel for default(shared) private(i,j,k) reduction(+:norm)
-        FAS_LOOP3_N(i,j,k,nx,ny,nz)
-        {
-      
-          idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
-
-          real_t temp = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k) - coarse_src[idx];
-
-          norm += temp * temp;
-
-
-          //evalue jac_source at right hand side of Jacobian linear equation
-          jac_rhs[idx] = -temp;  
-        }
-      }
-      if( _jacobianRelax(depth, norm, 1, 0) == false)
-      {
-        break;
-      }
-      
-      // get damping parameter lambda
-      if(_getLambda(depth, norm) == false)
-      {
-        std::cout<<"Can't fine suitable damping factor!!!\n";
-        throw -1;
+        #pragma omp parallel for default(shared) private(i,j,k)
+        for(i = 0; i < nx; i++)
+          for(j = 0; j < ny; j++)
+            for(k = ((colour - i - j) % c + c) % c; k < nz; k += c)
+              _nonlinearGaussSeidelPt(eqn_id, depth_idx, i, j, k);
       }
     }
-
-  } // end iterations loop
-
+  }
 }
 
-
 void FASMultigrid::_printStrip(fas_grid_t &out)
 {
   idx_t i;
@@ -1006,7 +4226,10 @@ FASMultigrid::~FASMultigrid()
       if(depth != max_depth) // can not delete the solution!!!!
         delete [] u_h[eqn_id][depth_idx]._array;
       delete [] coarse_src_h[eqn_id][depth_idx]._array;
-      delete [] tmp_h[eqn_id][depth_idx]._array;
+      if(tmp_h[eqn_id][depth_idx].pts > 0)
+        delete [] tmp_h[eqn_id][depth_idx]._array;
+      if(depth != max_depth)
+        delete [] coarse_appx_h[eqn_id][depth_idx]._array;
       delete [] damping_v_h[eqn_id][depth_idx]._array;
       delete [] jac_rhs_h[eqn_id][depth_idx]._array;
     }
@@ -1021,6 +4244,22 @@ FASMultigrid::~FASMultigrid()
     }
   }
 
+  _disableKernelJIT();
+  _freeLinearizationStorage();
+  delete [] linearizations;
+  delete [] jit_kernels;
+  delete [] eqn_kernels;
+  delete [] tilings;
+  delete [] nx_h;
+  delete [] ny_h;
+  delete [] nz_h;
+  delete [] rx_h;
+  delete [] ry_h;
+  delete [] rz_h;
+  delete [] padded_active;
+  delete [] padded_tapes;
+  delete [] tapes;
+
 }
 
 /**
@@ -1062,52 +4301,183 @@ void FASMultigrid::initializeRhoHeirarchy()
     }
   }
 
+  _compileEquationTapes();
 }
 
   
 void FASMultigrid::VCycle()
 {
-  _relaxSolution_GaussSeidel(max_depth, max_relax_iters);
+  _runCycle(max_depth);
+}
 
-   std::cout << "  Initial max. residual on fine grid is: "
-      << _getMaxResidualAllEqs(max_depth) << ".\n" << std::flush;
+/**
+ * @brief run one multigrid cycle as configured by cycle_cfg
+ *
+ * @param top_depth finest depth of cycle
+ * @return max. residual on top depth after cycle
+ */
+real_t FASMultigrid::_runCycle(idx_t top_depth)
+{
+  _cycle(top_depth, cycle_cfg.type, true);
 
-   idx_t depth, coarse_depth;
+  real_t residual = _getMaxResidualAllEqs(top_depth);
+  std::cout << "  Final max. residual on fine grid is: "
+    << residual << ".\n" << std::flush;
 
-   for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
-   {
-     for(depth = max_depth; min_depth < depth; --depth)
-       _computeCoarseRestrictions(eqn_id, depth);
-     _copyGrid(u_h, tmp_h, eqn_id, min_depth);
-   }
+  return residual;
+}
 
-   for(coarse_depth = min_depth; coarse_depth < max_depth; coarse_depth++)
-   {
-     _relaxSolution_GaussSeidel(coarse_depth, max_relax_iters);
-    
-    std::cout << "    Working on upward stroke at depth " << coarse_depth
-              << "; residual after solving is: "
-              << _getMaxResidualAllEqs(coarse_depth) << ".\n" << std::flush;
-    
-    // tmp should hold appx. soln; convert to error
-    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
-      _changeApproximateSolutionToError(tmp_h[eqn_id], u_h[eqn_id], coarse_depth);
+/**
+ * @brief recursive FAS cycle
+ * @details relax, restrict u and compute coarse_src, visit coarser
+ *  depth (once for V-cycles, gamma times for W-cycles, an F-cycle then a
+ *  V-cycle for F-cycles), correct u from the coarse solution and relax;
+ *  the restricted u is kept in coarse_appx_h while coarser depths run.
+ *  Reports the residual on the top depth after pre-smoothing, and on
+ *  every coarser depth once it is relaxed on the upward stroke.
+ *
+ * @param depth depth of cycle
+ * @param type type of cycle (see cycle_t)
+ * @param top whether depth is the finest depth of the cycle
+ */
+void FASMultigrid::_cycle(idx_t depth, cycle_t type, bool top)
+{
+  idx_t depth_idx = _dIdx(depth);
+
+  if(depth == min_depth)
+  {
+    _solveCoarsest(depth, cycle_cfg.coarse_relax);
+    std::cout << "    Working on upward stroke at depth " << depth
+      << "; residual after solving is: "
+      << _getMaxResidualAllEqs(depth) << ".\n" << std::flush;
+    return;
+  }
+
+  _relaxSolution_GaussSeidel(depth, cycle_cfg.pre_relax[depth_idx]);
+
+  if(top)
+    std::cout << "  Initial max. residual on fine grid is: "
+      << _getMaxResidualAllEqs(depth) << ".\n" << std::flush;
+
+  _computeCoarseRestrictions(depth);
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    _copyGrid(u_h, coarse_appx_h, eqn_id, depth - 1);
+
+  if(type == f_cycle)
+  {
+    _cycle(depth - 1, f_cycle);
+    _cycle(depth - 1, v_cycle);
+  }
+  else
+  {
+    idx_t visits = (type == w_cycle) ? cycle_cfg.gamma : 1;
+    for(idx_t visit = 0; visit < visits; visit++)
+      _cycle(depth - 1, type);
+  }
+
+  // coarse_appx holds restricted u, so the coarse error is u - coarse_appx
+  bool post_relax = cycle_cfg.post_relax[depth_idx] > 0;
+  fas_residual_norms residual = _correctFromCoarse(depth, post_relax);
+
+  _relaxSolution_GaussSeidel(depth, cycle_cfg.post_relax[depth_idx],
+    post_relax ? &residual : NULL);
+
+  if(!top)
+    std::cout << "    Working on upward stroke at depth " << depth
+      << "; residual after solving is: "
+      << _getMaxResidualAllEqs(depth) << ".\n" << std::flush;
+}
+
+/**
+ * @brief set cycle type and the same smoothing on every depth
+ * @details finer control is available through cycle_cfg
+ *
+ * @param type type of cycle (see cycle_t)
+ * @param pre relaxation iterations before coarse grid correction
+ * @param post relaxation iterations after coarse grid correction
+ * @param gamma coarse grid visits per depth for W-cycles
+ */
+void FASMultigrid::setCycle(cycle_t type, idx_t pre, idx_t post, idx_t gamma)
+{
+  cycle_cfg.type = type;
+  cycle_cfg.gamma = gamma;
+  cycle_cfg.pre_relax.assign(total_depths, pre);
+  cycle_cfg.post_relax.assign(total_depths, post);
+  cycle_cfg.coarse_relax = std::max(pre + post, max_relax_iters);
+}
+
+/**
+ * @brief choose grid transfer operators between a depth and the next
+ *  coarser one
+ * @details restriction of source grids happens in
+ *  initializeRhoHeirarchy(), so operators should be chosen before it
+ *
+ * @param depth finer of the two depths
+ * @param restriction restriction operator
+ * @param prolongation prolongation operator
+ */
+void FASMultigrid::setTransferOperators(idx_t depth, restriction_t restriction,
+  prolongation_t prolongation)
+{
+  if(depth <= min_depth || depth > max_depth)
+  {
+    std::cout << "No coarser depth to transfer to from depth " << depth << ".\n";
+    throw -1;
+  }
+  cycle_cfg.restriction[_dIdx(depth)] = restriction;
+  cycle_cfg.prolongation[_dIdx(depth)] = prolongation;
+}
+
+/**
+ * @brief full multigrid (nested iteration) solve
+ * @details Sources on the finest grid are restricted through the
+ *  heirarchy (rho_h already is, see initializeRhoHeirarchy()) along with
+ *  the initial guess. The problem is then solved on the coarsest grid,
+ *  and the solution interpolated to each finer grid in turn, where it
+ *  is improved by cycles (see cycle_cfg) with that grid as finest one.
+ *
+ * @param cycles_per_depth cycles on each depth after interpolation
+ */
+void FASMultigrid::FMG(idx_t cycles_per_depth)
+{
+  if(!tapes_compiled)
+    _compileEquationTapes();
+  else
+    _syncPaddedSources();
+
+  idx_t depth;
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    for(depth = max_depth; depth > min_depth; --depth)
+    {
+      _restrictFine2coarse(coarse_src_h[eqn_id], depth);
+      _restrictFine2coarse(u_h[eqn_id], depth);
+    }
+
+  _solveCoarsest(min_depth, fmg_coarse_relax_iters);
+  std::cout << "  FMG: residual on coarsest grid is: "
+    << _getMaxResidualAllEqs(min_depth) << ".\n" << std::flush;
 
-    // tmp should hold error
+  for(depth = min_depth + 1; depth <= max_depth; depth++)
+  {
     for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
-      _correctFineFromCoarseErr_Err2Appx(tmp_h[eqn_id], u_h[eqn_id], coarse_depth+1);
+      _interpolateCoarse2fine(u_h[eqn_id], depth - 1);
 
-    // tmp now holds appx. soln on finer grid;
-    // phi_h now holds corrected solution on finer grid
-   }
+    for(idx_t cycle = 0; cycle < cycles_per_depth; cycle++)
+      _runCycle(depth);
 
-    _relaxSolution_GaussSeidel(max_depth, max_relax_iters);
-    std::cout << "  Final max. residual on fine grid is: "
-              << _getMaxResidualAllEqs(max_depth) << ".\n" << std::flush;
+    std::cout << "  FMG: residual at depth " << depth << " is: "
+      << _getMaxResidualAllEqs(depth) << ".\n" << std::flush;
+  }
 }
 
 void FASMultigrid::VCycles(idx_t num_cycles)
 {
+  if(!tapes_compiled)
+    _compileEquationTapes();
+  else
+    _syncPaddedSources();
+
   for(idx_t cycle = 0; cycle < num_cycles; ++cycle)
   {
     VCycle();
@@ -1119,15 +4489,77 @@ void FASMultigrid::VCycles(idx_t num_cycles)
   
   for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
   {
+    fas_grid_t & u = u_h[eqn_id][max_depth_idx];
+    fas_grid_stats stats = fas_reduce_stats(u._array, u.pts);
     std::cout << " Solution for variable "<< eqn_id<<" has average / min / max value: "
-              << u_h[eqn_id][max_depth_idx].avg() << " / " << u_h[eqn_id][max_depth_idx].min() << " / " << u_h[eqn_id][max_depth_idx].max() << ".\n" << std::flush;
+              << stats.avg << " / " << stats.min << " / " << stats.max << ".\n" << std::flush;
+
+  }
+}
+
+/**
+ * @brief cycle until the max. residual on the finest grid is below a
+ *  tolerance
+ * @details Stops early when the solve stagnates (residual reduction
+ *  factor above solve_stagnation_factor for solve_stagnation_cycles
+ *  cycles in a row) or diverges (residual not finite, or larger than
+ *  solve_divergence_ratio times the initial residual).
+ *
+ * @param tolerance target max. residual
+ * @param max_cycles maximum number of cycles
+ * @return cycles used, residuals, reduction factor of each cycle and
+ *  reason for stopping
+ */
+solve_result FASMultigrid::solve(real_t tolerance, idx_t max_cycles)
+{
+  if(!tapes_compiled)
+    _compileEquationTapes();
+  else
+    _syncPaddedSources();
+
+  solve_result result;
+  result.cycles = 0;
+  result.initial_residual = result.final_residual = _getMaxResidualAllEqs(max_depth);
+  result.status = solve_max_cycles;
 
+  idx_t slow_cycles = 0;
+  real_t residual = result.initial_residual;
+
+  if(residual <= tolerance)
+    result.status = solve_converged;
+
+  while(result.status == solve_max_cycles && result.cycles < max_cycles)
+  {
+    real_t new_residual = _runCycle(max_depth);
+    result.cycles++;
+    result.factors.push_back(new_residual / residual);
+    result.final_residual = new_residual;
+
+    if(new_residual <= tolerance)
+      result.status = solve_converged;
+    else if(!std::isfinite(new_residual)
+        || new_residual > solve_divergence_ratio * result.initial_residual)
+      result.status = solve_diverged;
+    else
+    {
+      slow_cycles = (new_residual > solve_stagnation_factor * residual) ? slow_cycles + 1 : 0;
+      if(slow_cycles >= solve_stagnation_cycles)
+        result.status = solve_stagnated;
+    }
+
+    residual = new_residual;
   }
+
+  const char * status_str[] = {"converged", "reached max. cycles", "stagnated", "diverged"};
+  std::cout << "  Solve " << status_str[result.status] << " after " << result.cycles
+    << " cycles; residual is: " << result.final_residual << "\n" << std::flush;
+
+  return result;
 }
 
 void FASMultigrid::printSolutionStrip(idx_t depth)
 {
-  _printStrip(u_h[0][depth]);
+  _printStrip(u_h[0][_dIdx(depth)]);
 }
 
 
@@ -1140,6 +4572,8 @@ void FASMultigrid::setPolySrcAtPt(idx_t eqn_id, idx_t mol_id, idx_t i, idx_t j,
   {
     rho_h[eqn_id][mol_id][max_depth_idx].init(
       nx_h[max_depth_idx], ny_h[max_depth_idx], nz_h[max_depth_idx]);
+    // tapes refer to the source grids that existed when compiled
+    tapes_compiled = false;
   }
 
   rho_h[eqn_id][mol_id][max_depth_idx][idx] = value;
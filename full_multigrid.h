@@ -7,9 +7,14 @@
 #include <iomanip>
 #include <cmath>
 #include <cstdio>
+#include <vector>
+#include <string>
 
 #include "../../cosmo_types.h"
 #include "../../cosmo_macros.h"
+#include "equation_kernel.h"
+#include "grid_tiling.h"
+#include "grid_reduction.h"
 
 #define PI  (4.0*atan(1.0))
 
@@ -18,9 +23,29 @@
     for(j=0; j<ny; ++j)                   \
       for(k=0; k<nz; ++k)
 
+// largest |exponent| handled by multiplication chains
+#define FAS_MAX_POW_INT 64
+// number of squarings needed for FAS_MAX_POW_INT
+#define FAS_MAX_POW_BITS 7
+// largest number of distinct powers shared within one equation
+#define FAS_MAX_POW_SLOTS 32
+// largest number of atoms in a term for a stored linearization
+#define FAS_MAX_MOL_OPS 16
+// largest number of step lengths evaluated in one line search sweep
+#define FAS_MAX_LINE_SEARCH_CANDIDATES 8
+// smallest number of points an axis is coarsened to
+#define FAS_MIN_AXIS_POINTS 2
+// weight of damped Jacobi sweeps of the Jacobian equation
+#ifndef FAS_JACOBI_WEIGHT
+#define FAS_JACOBI_WEIGHT (6.0/7.0)
+#endif
+
 namespace cosmo
 {
 
+class FASKernelJIT;
+class FASJITEquationKernel;
+
 /**
  * @brief single element in a term
  */
@@ -28,6 +53,8 @@ typedef struct{
   idx_t type;    ///< element type; 0 for constant function, 1 for polynomial, 2-10 for single and double derivatives, 11 for laplacian (see also enum atom_type)
   idx_t u_id;    ///< id of varible needs to be solved, won't be visited when type = 0
   real_t value;  ///< exponent value, has meaning only when type = 1 (polynomial)
+  idx_t pow_class; ///< exponent class, set by FASMultigrid::add_atom_to_eqn() (see enum pow_class_t)
+  idx_t pow_n;     ///< exponent for integer class, twice the exponent for half-integer class
 } atom;
 
 
@@ -46,6 +73,8 @@ class molecule
   molecule()
   {
     atom_n = 0;
+    atoms = NULL;
+    const_coef = 0.0;
   }
 
   ~molecule()
@@ -67,6 +96,154 @@ class molecule
   }
 };
 
+/**
+ * @brief single weighted grid access of a compiled stencil
+ */
+typedef struct{
+  idx_t di, dj, dk; ///< offsets in x, y and z direction
+  idx_t off;        ///< linear offset in a padded grid, only used by linear tapes
+  real_t coef;      ///< stencil weight, grid spacing already folded in
+} tape_tap;
+
+/**
+ * @brief compiled "atom": a stencil or a power of one variable
+ */
+typedef struct{
+  idx_t u_id;               ///< id of variable the atom acts on
+  idx_t type;               ///< atom type (see FASMultigrid::atom_type)
+  real_t value;             ///< exponent, only used by polynomial ops
+  idx_t slot, der_slot;     ///< shared power slots of u^value and u^(value-1), -1 if not shared
+  idx_t pow_class, pow_n;   ///< exponent class of value (see FASMultigrid::pow_class_t)
+  real_t * u;               ///< base pointer of u_h[u_id] at this depth
+  real_t * v;               ///< base pointer of damping_v_h[u_id] at this depth
+  idx_t tap_begin, tap_end; ///< range of stencil taps, only used by stencil ops
+  real_t center_coef;       ///< weight of the (0,0,0) tap, i.e. contribution to Jacobian diagonal
+} tape_op;
+
+/**
+ * @brief power of a variable shared by all terms of an equation
+ */
+typedef struct{
+  idx_t pow_class; ///< exponent class (see FASMultigrid::pow_class_t)
+  idx_t pow_n;     ///< integer exponent, or twice a half-integer exponent
+  real_t value;    ///< exponent
+} tape_pow;
+
+/**
+ * @brief all shared powers of one variable within an equation
+ * @details powers are assembled from a single set of repeated squarings
+ *  (and one square root for half-integer exponents)
+ */
+typedef struct{
+  real_t * u;                 ///< base pointer of variable at this depth
+  idx_t val_begin, val_end;   ///< slots needed for F(u)
+  idx_t der_begin, der_end;   ///< slots only needed for dF/du
+  idx_t n_squares;            ///< number of squarings needed
+  bool need_root;             ///< whether a square root is needed
+} tape_pow_group;
+
+/**
+ * @brief compiled "molecule"
+ * @details polynomial and stencil ops are stored in two separate
+ *  ranges so that evaluation never has to branch on atom type
+ */
+typedef struct{
+  real_t const_coef;          ///< constant coefficient of term
+  real_t * rho;               ///< base pointer of source grid, NULL when term has no source
+  idx_t poly_begin, poly_end; ///< range of polynomial ops
+  idx_t sten_begin, sten_end; ///< range of stencil ops
+} tape_mol;
+
+/**
+ * @brief flat evaluation tape for all equations at a single depth
+ * @details Built once by FASMultigrid::_compileEquationTapes(), after
+ *  which per-point evaluation needs no atom type dispatch, no heirarchy
+ *  lookups and no periodic index arithmetic: neighbour indexes are read
+ *  from per-axis offset tables that already contain the periodic wrap.
+ *  A linear tape addresses padded grids (see
+ *  FASMultigrid::_compilePaddedTape()), where neighbour indexes are
+ *  idx + tap offset.
+ */
+typedef struct{
+  std::vector<tape_tap> taps;
+  std::vector<tape_op> ops;
+  std::vector<tape_mol> mols;
+  std::vector<idx_t> eqn_mol_begin; ///< molecules of eqn_id are [eqn_mol_begin[eqn_id], eqn_mol_begin[eqn_id+1])
+  std::vector<tape_pow> pows;             ///< shared power slots, numbered per equation
+  std::vector<tape_pow_group> pow_groups; ///< slots grouped by variable
+  std::vector<idx_t> eqn_pow_begin;       ///< slots of eqn_id start at pows[eqn_pow_begin[eqn_id]]
+  std::vector<idx_t> eqn_group_begin;     ///< groups of eqn_id are [eqn_group_begin[eqn_id], eqn_group_begin[eqn_id+1])
+  idx_t radius;  ///< largest stencil offset of any tap
+  bool mixed;    ///< whether any tap is offset in more than one direction
+  std::vector<idx_t> x_off, y_off, z_off; ///< wrapped offsets, index shifted by stencil radius
+  idx_t * xo, * yo, * zo; ///< pointers into offset tables, valid for index range [-radius, n + radius)
+  std::vector<real_t *> u_ptrs, v_ptrs, rho_ptrs; ///< grid base pointers referenced by ctx
+  std::vector<fas_kernel_ctx> ctx; ///< equation kernel context, one per equation
+  bool linear;   ///< whether grids are padded with ghost layers, making tap offsets linear
+  std::vector<std::vector<real_t> > pad_u, pad_v, pad_rho; ///< padded mirrors of grids, only used by linear tapes
+} equation_tape;
+
+/**
+ * @brief stored coefficient grid of one term of a linearized equation
+ * @details dF/du_{u_id} * v contains coef * S(v), where S is the stencil
+ *  of atom type "type", or the identity for polynomial atoms
+ */
+typedef struct{
+  idx_t u_id;         ///< variable the term acts on
+  idx_t type;         ///< atom type of stencil
+  idx_t op;           ///< tape op providing stencil taps, -1 for polynomial terms
+  real_t center_coef; ///< weight of the (0,0,0) tap
+  real_t * v;         ///< base pointer of damping_v_h[u_id] at this depth
+  real_t * coef;      ///< coefficient grid
+} frozen_term;
+
+/**
+ * @brief Jacobian of all equations at a single depth
+ * @details u is frozen while the Jacobian equation is relaxed, so the
+ *  coefficients of dF/du * v are computed once per Newton step; after
+ *  that each Jacobi sweep is a variable-coefficient stencil application
+ */
+typedef struct{
+  bool stored;                      ///< whether coefficients are stored, otherwise Jacobian is applied matrix-free
+  std::vector<frozen_term> terms;
+  std::vector<idx_t> eqn_term_begin; ///< terms of eqn_id are [eqn_term_begin[eqn_id], eqn_term_begin[eqn_id+1])
+  std::vector<idx_t> op_term;        ///< term each tape op contributes to
+  std::vector<real_t *> diag;        ///< dF_eqn/du_eqn diagonal, one grid per equation
+} frozen_linearization;
+
+/**
+ * @brief outcome of a single line search
+ */
+typedef struct{
+  real_t lambda;      ///< accepted step length, 0 if none found
+  idx_t evaluations;  ///< number of step lengths for which |F(u + \lambda v)| was evaluated
+  idx_t sweeps;       ///< number of sweeps over the grid needed for those evaluations
+  bool success;       ///< whether a step length was accepted
+  bool residual_stored; ///< whether jac_rhs holds -(F(u) - coarse_src) at the accepted step
+  real_t max_residual;  ///< max. residual at the accepted step, if residual_stored
+  real_t norm;          ///< |F(u) - coarse_src|^2 at the accepted step, if residual_stored
+} line_search_result;
+
+// enum for outcome of FASMultigrid::solve()
+enum solve_status_t
+{
+  solve_converged,  // residual below tolerance
+  solve_max_cycles, // maximum number of cycles reached
+  solve_stagnated,  // residual stopped decreasing
+  solve_diverged    // residual grew or is not finite
+};
+
+/**
+ * @brief outcome of FASMultigrid::solve()
+ */
+typedef struct{
+  idx_t cycles;                ///< number of cycles run
+  real_t initial_residual;     ///< max. residual before first cycle
+  real_t final_residual;       ///< max. residual after last cycle
+  std::vector<real_t> factors; ///< residual reduction factor of each cycle
+  solve_status_t status;       ///< reason for stopping
+} solve_result;
+
 class FASMultigrid
 {
   private:
@@ -81,6 +258,7 @@ class FASMultigrid
   // define heirarchy of references to grids
   fas_heirarchy_set_t u_h;             ///< field seeking a solution for
   fas_heirarchy_set_t tmp_h;           ///< reusable grid for storing intermediate calculations
+  fas_heirarchy_set_t coarse_appx_h;   ///< restricted u, kept while coarser depths are cycled
   fas_heirarchy_set_t coarse_src_h;    ///< multigrid source term
   fas_heirarchy_set_t jac_rhs_h;       ///< - F(u) which is rhs of Jacob Linear function
   fas_heirarchy_set_t damping_v_h;     ///< _lap (u) - f, used to calculate F(u + \lambda v)
@@ -91,6 +269,10 @@ class FASMultigrid
   idx_t * molecule_n; ///< number of molecules for each equation
 
   idx_t *nx_h, *ny_h, *nz_h;  ///< number of grid points in each direction at different depths
+  idx_t *rx_h, *ry_h, *rz_h;  ///< coarsening ratio (1 or 2) in each direction from a depth to the next coarser one
+  real_t box_len[3];          ///< length of box in each direction
+  bool semi_coarsening;       ///< whether only strongly coupled directions are coarsened
+  idx_t line_axis;            ///< direction of lines in line relaxation (1, 2, 3), 0 to choose per depth
 
   real_t relaxation_tolerance;  ///< desired precision when performing relaxation
 
@@ -100,7 +282,47 @@ class FASMultigrid
 
   idx_t der_type[12 /* number of items in enum atom_type */][2 /* derivative directions(s) */];      ///< vectors that stores devivative directions
 
-  real_t double_der_coef[9];  ///< vectors that stores coefficients of f(x,y,z) for different order stencils, used for jac equation iteration
+  equation_tape * tapes;  ///< compiled equations at each depth
+  bool tapes_compiled;    ///< whether tapes reflect the current equations
+
+  equation_tape * padded_tapes; ///< tapes addressing padded mirrors of grids at each depth
+  bool * padded_active;         ///< whether padded tapes are in use at each depth
+  bool padded_layout;           ///< whether read-only sweeps use padded grids
+
+  fas_tiling * tilings;         ///< tiles of grid sweeps at each depth
+  std::size_t tile_cache_bytes; ///< cache per thread tiles are sized for
+
+  idx_t jacobi_fused_sweeps;            ///< Jacobi sweeps of a stored Jacobian per pass over the grids
+  bool concurrent_equations;            ///< whether Jacobi and line sweeps update all equations at once
+  std::vector<real_t> temporal_scratch; ///< results of Jacobi sweeps before they replace damping_v
+
+  FASEquationKernel ** eqn_kernels;    ///< specialized kernel per equation, NULL to use tape
+  FASKernelJIT * jit;                  ///< JIT compiler, NULL unless enabled
+  FASJITEquationKernel ** jit_kernels; ///< kernels loaded by jit, one per equation
+
+  frozen_linearization * linearizations; ///< stored Jacobians at each depth
+  std::size_t linearization_budget;      ///< bytes available for stored Jacobians
+  bool linearization_lines;              ///< whether storage was planned for line relaxation
+
+  idx_t newton_krylov_dim;     ///< GMRES iterations before restart (newton scheme)
+  idx_t newton_max_restarts;   ///< maximum number of GMRES restarts
+  idx_t newton_precond_cycles; ///< linear multigrid cycles preconditioning the finest depth
+  idx_t newton_smooth_sweeps;  ///< Jacobi sweeps before and after coarse correction
+  idx_t newton_coarse_sweeps;  ///< Jacobi sweeps on the coarsest depth, or as preconditioner
+  real_t newton_forcing;       ///< largest relative tolerance of GMRES
+
+  idx_t line_search_candidates;      ///< step lengths evaluated per sweep by batched line searches
+  idx_t line_search_max_evaluations; ///< step lengths tried before giving up
+  real_t line_search_c;              ///< sufficient decrease parameter of Armijo condition
+
+  idx_t fmg_coarse_relax_iters; ///< relaxation iterations solving the coarsest grid in FMG()
+
+  idx_t coarse_direct_max_unknowns; ///< largest system solved directly on the coarsest depth
+  idx_t coarse_newton_iters;        ///< maximum Newton iterations of direct coarse solve
+
+  real_t solve_stagnation_factor; ///< residual reduction factor solve() considers stagnating
+  idx_t solve_stagnation_cycles;  ///< consecutive stagnating cycles before solve() gives up
+  real_t solve_divergence_ratio;  ///< growth of residual over initial one solve() considers divergence
 
   /**
    * @brief indexing scheme of a grid heirarchy
@@ -115,6 +337,15 @@ class FASMultigrid
     return depth - min_depth;
   }
 
+  /**
+   * @brief tape evaluations at a depth currently go through
+   * @return padded tape inside a padded sweep, unpadded tape otherwise
+   */
+  inline equation_tape & _tape(idx_t depth_idx)
+  {
+    return padded_active[depth_idx] ? padded_tapes[depth_idx] : tapes[depth_idx];
+  }
+
   /**
    * @brief return sign of argument
    * @details return zerp when argument is zero
@@ -164,10 +395,93 @@ class FASMultigrid
   {
     inexact_newton,
     inexact_newton_constrained, // inexact Newton with volume constraint enforced
-    newton
+    newton,                     // Jacobian-free Newton-Krylov (GMRES)
+    nonlinear_gauss_seidel,     // pointwise Newton, multicolour ordering
+    line_relaxation             // inexact Newton, Jacobian relaxed line by line
   };
 
   relax_t relax_scheme;
+
+  // enum for line search used by newton type relaxation schemes
+  enum line_search_t
+  {
+    line_search_scan,   // \lambda = 1, 0.99, ..., 0.01 until |F| decreases
+    line_search_armijo, // Armijo backtracking with quadratic / cubic interpolation
+    line_search_multi   // Armijo condition on \lambda = 1, 1/2, 1/4, ... in batches
+  };
+
+  line_search_t line_search;
+
+  // enum for solver used on the coarsest depth
+  enum coarse_solver_t
+  {
+    coarse_relax,  // relaxation with coarse_relax iterations
+    coarse_direct  // Newton iteration with dense LU solves, relaxation if too large or singular
+  };
+
+  coarse_solver_t coarse_solver;
+
+  // enum for multigrid cycle type
+  enum cycle_t
+  {
+    v_cycle,
+    w_cycle,
+    f_cycle
+  };
+
+  // enum for restriction operators
+  enum restriction_t
+  {
+    restrict_injection,       // value of coinciding fine point
+    restrict_half_weighting,  // 7-point half weighting
+    restrict_full_weighting   // 27-point full weighting
+  };
+
+  // enum for prolongation operators
+  enum prolongation_t
+  {
+    prolong_trilinear,
+    prolong_tricubic
+  };
+
+  /**
+   * @brief multigrid cycle schedule
+   * @details smoothing counts are indexed by depth index, transfer
+   *  operators by depth index of the finer depth
+   */
+  typedef struct{
+    cycle_t type;                  ///< type of cycle
+    idx_t gamma;                   ///< coarse grid visits per depth for W-cycles
+    std::vector<idx_t> pre_relax;  ///< relaxation iterations before coarse grid correction
+    std::vector<idx_t> post_relax; ///< relaxation iterations after coarse grid correction
+    idx_t coarse_relax;            ///< relaxation iterations on coarsest depth
+    std::vector<restriction_t> restriction;   ///< restriction to next coarser depth
+    std::vector<prolongation_t> prolongation; ///< prolongation from next coarser depth
+  } cycle_config;
+
+  cycle_config cycle_cfg; ///< cycle run by VCycle(), VCycles() and FMG()
+
+  // grid transfer operator, (grid heirarchy, depth of finer / coarser grid)
+  typedef void (FASMultigrid::*transfer_fn)(fas_heirarchy_t, idx_t);
+  static const transfer_fn restriction_ops[];  ///< indexed by restriction_t
+  static const transfer_fn prolongation_ops[]; ///< indexed by prolongation_t
+
+  // prolongation of a single fine row, (fine depth index, coarse grid,
+  // grid subtracted from it or NULL, row, scratch, fine row, whether to add)
+  typedef void (FASMultigrid::*prolong_row_fn)(idx_t, const real_t *, const real_t *,
+    idx_t, std::vector<real_t> &, real_t *, bool);
+  static const prolong_row_fn prolongation_row_ops[]; ///< indexed by prolongation_t
+
+  line_search_result last_line_search; ///< statistics of most recent line search
+  idx_t line_search_evaluations;       ///< total step lengths evaluated by line searches
+
+  // enum for classes of exponents of polynomial atoms
+  enum pow_class_t
+  {
+    pow_integer,      // multiplication chain
+    pow_half_integer, // multiplication chain and square root
+    pow_generic       // pow()
+  };
   
   enum atom_type
   {
@@ -188,11 +502,65 @@ class FASMultigrid
 
   FASMultigrid(fas_grid_t u_in[], idx_t u_n_in, idx_t molecule_n_in [],
                idx_t max_depth_in, idx_t max_relax_iters_in,
-               real_t relaxation_tolerance_in);
+               real_t relaxation_tolerance_in, const real_t * box_len_in = NULL,
+               bool semi_coarsening_in = false, idx_t min_depth_in = 1);
   ~FASMultigrid();
 
   void add_atom_to_eqn(atom atom_in, idx_t molecule_id, idx_t eqn_id);
 
+  static void _classifyExponent(real_t value, idx_t & pow_class, idx_t & pow_n);
+
+  void _evaluateSharedPowers(equation_tape & tape, idx_t eqn_id, idx_t idx,
+    bool with_der, real_t * pv);
+
+  void _appendAtomTaps(std::vector<tape_tap> & taps, idx_t type, const real_t h[4]);
+
+  void _planLevels();
+
+  void _compileEquationTapes();
+
+  void _compilePaddedTape(idx_t depth_idx);
+
+  static void _fillPadded(const real_t * grid, idx_t nx, idx_t ny, idx_t nz,
+    idx_t R, real_t * padded);
+
+  bool _beginPaddedSweep(idx_t depth_idx, bool with_v);
+
+  void _endPaddedSweep(idx_t depth_idx);
+
+  void _syncPaddedSources();
+
+  void setPaddedLayout(bool enable);
+
+  void _planTilings();
+
+  void setTileCacheSize(std::size_t bytes);
+
+  void setEquationKernel(idx_t eqn_id, FASEquationKernel * kernel);
+
+  std::string _stencilSource(idx_t type, const std::string & grid);
+
+  std::string _stencilCenterSource(idx_t type);
+
+  std::string _powSource(real_t value, const std::string & x);
+
+  std::string _generateKernelSource();
+
+  bool enableKernelJIT(const std::string & cache_dir = "fas_kernel_cache");
+
+  void _disableKernelJIT();
+
+  void setLinearizationMemoryBudget(std::size_t bytes);
+
+  void _planLinearizationStorage();
+
+  void _freeLinearizationStorage();
+
+  bool _freezeLinearization(idx_t depth_idx);
+
+  real_t _evaluateFrozenDerEquation(idx_t eqn_id, idx_t depth_idx, idx_t i,
+    idx_t j, idx_t k);
+
   real_t _evaluateEllipticEquationPt(idx_t eqn_id, idx_t depth_idx, idx_t i,
     idx_t j, idx_t k);
 
@@ -216,6 +584,25 @@ class FASMultigrid
 
   void _restrictFine2coarse(fas_heirarchy_t grid_heirarchy, idx_t fine_depth);
 
+  void _restrictInjection(fas_heirarchy_t grid_heirarchy, idx_t fine_depth);
+
+  void _restrictHalfWeighting(fas_heirarchy_t grid_heirarchy, idx_t fine_depth);
+
+  void _restrictFullWeighting(fas_heirarchy_t grid_heirarchy, idx_t fine_depth);
+
+  void _prolongTrilinear(fas_heirarchy_t grid_heirarchy, idx_t coarse_depth);
+
+  void _prolongTricubic(fas_heirarchy_t grid_heirarchy, idx_t coarse_depth);
+
+  void _prolongRowTrilinear(idx_t fine_idx, const real_t * coarse,
+    const real_t * coarse_sub, idx_t r, std::vector<real_t> & row, real_t * out, bool add);
+
+  void _prolongRowTricubic(idx_t fine_idx, const real_t * coarse,
+    const real_t * coarse_sub, idx_t r, std::vector<real_t> & row, real_t * out, bool add);
+
+  void setTransferOperators(idx_t depth, restriction_t restriction,
+    prolongation_t prolongation);
+
   void _interpolateCoarse2fine(fas_heirarchy_t grid_heirarchy,
     idx_t coarse_depth);
 
@@ -228,7 +615,9 @@ class FASMultigrid
 
   real_t _getMaxResidualAllEqs(idx_t depth);
 
-  void _computeCoarseRestrictions(idx_t eqn_id, idx_t fine_depth);
+  fas_residual_norms _evaluateRelaxResidual(idx_t depth_idx);
+
+  void _computeCoarseRestrictions(idx_t fine_depth, bool restrict_u = true);
 
   void _changeApproximateSolutionToError(fas_heirarchy_t  appx_to_err_h,
     fas_heirarchy_t  exact_soln_h, idx_t depth);
@@ -239,13 +628,73 @@ class FASMultigrid
   void _copyGrid(fas_heirarchy_t from_h[], fas_heirarchy_t to_h[],
     idx_t eqn_id, idx_t depth);
 
+  fas_residual_norms _correctFromCoarse(idx_t fine_depth, bool with_residual);
+
+  void _evaluateShiftedNorms(idx_t depth_idx, const real_t * lambdas, idx_t n,
+    real_t * sums, real_t * max_residual = NULL);
+
+  void _shiftSolution(idx_t depth_idx, real_t shift);
+
   bool _getLambda( idx_t depth, real_t norm);
 
+  void setLineSearch(line_search_t type, idx_t candidates = 4);
+
+  real_t _evaluateJacobianProductPt(idx_t eqn_id, idx_t depth_idx, idx_t i,
+    idx_t j, idx_t k, bool frozen);
+
+  void _jacobiSweep(idx_t depth_idx, bool frozen);
+
+  void _jacobiSweeps(idx_t depth_idx, bool frozen, idx_t n_sweeps);
+
+  idx_t _lineAxis(idx_t depth_idx);
+
+  void _lineJacobianSolve(idx_t depth_idx, idx_t axis, idx_t eqn_id, idx_t a, idx_t b,
+    std::vector<real_t> & work, real_t * out = NULL);
+
+  void _lineJacobianSweep(idx_t depth_idx);
+
+  void setLineRelaxation(idx_t axis = 0);
+
+  void _temporalJacobiSweeps(idx_t depth_idx, idx_t n_sweeps);
+
+  void setTemporalBlocking(idx_t n_sweeps);
+
+  void setConcurrentEquations(bool enable);
+
   bool _jacobianRelax( idx_t depth, real_t norm, real_t C, idx_t p);
 
+  void _applyJacobian(idx_t depth_idx, const real_t * w, real_t * jw, bool frozen);
+
+  void _linearCorrectionCycle(idx_t depth, const std::vector<bool> & frozen);
+
+  void _applyNewtonPreconditioner(idx_t depth, const real_t * r, real_t * z,
+    const std::vector<bool> & frozen);
+
+  bool _solveJacobianGMRES(idx_t depth, const std::vector<real_t> & b,
+    std::vector<real_t> & x, real_t tol, const std::vector<bool> & frozen);
+
+  bool _newtonKrylovStep(idx_t depth);
+
+  void setNewtonKrylovParameters(idx_t krylov_dim, idx_t max_restarts,
+    idx_t precond_cycles);
+
   bool _singularityExists(idx_t eqn_id, idx_t depth);
 
-  void _relaxSolution_GaussSeidel( idx_t depth, idx_t max_iterations);
+  void _relaxSolution_GaussSeidel( idx_t depth, idx_t max_iterations,
+    const fas_residual_norms * initial_residual = NULL);
+
+  bool _directNewtonStep(idx_t depth);
+
+  void _solveCoarsest(idx_t depth, idx_t max_iterations);
+
+  void setCoarseSolver(coarse_solver_t type, idx_t max_unknowns = 512);
+
+  void _nonlinearGaussSeidelPt(idx_t eqn_id, idx_t depth_idx, idx_t i,
+    idx_t j, idx_t k);
+
+  idx_t _stencilRadius(idx_t depth_idx, bool & mixed);
+
+  void _nonlinearGaussSeidelSweep(idx_t depth);
 
   void _printStrip(fas_grid_t & out_h);
 
@@ -253,8 +702,18 @@ class FASMultigrid
 
   void VCycle();
 
+  real_t _runCycle(idx_t top_depth);
+
+  void _cycle(idx_t depth, cycle_t type, bool top = false);
+
+  void setCycle(cycle_t type, idx_t pre, idx_t post, idx_t gamma = 2);
+
+  void FMG(idx_t cycles_per_depth = 1);
+
   void VCycles(idx_t num_cycles);
 
+  solve_result solve(real_t tolerance, idx_t max_cycles);
+
   void setPolySrcAtPt(idx_t eqn_id, idx_t mol_id, idx_t i, idx_t j, idx_t k,
     real_t value);
 
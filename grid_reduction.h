@@ -0,0 +1,215 @@
+#ifndef FAS_GRID_REDUCTION_H
+#define FAS_GRID_REDUCTION_H
+
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "../../cosmo_types.h"
+#include "grid_tiling.h"
+
+/**
+ * Parallel reductions over grids. All of them use OpenMP reduction
+ * clauses or per-thread partial results, so threads never wait on each
+ * other while sweeping a grid.
+ */
+
+namespace cosmo
+{
+
+/**
+ * @brief summary of the values of a grid
+ */
+typedef struct{
+  real_t min, max;   ///< smallest and largest value
+  real_t sum;        ///< sum of values
+  real_t sum_sq;     ///< sum of squared values
+  real_t max_abs;    ///< largest absolute value
+  real_t avg;        ///< average value
+} fas_grid_stats;
+
+/**
+ * @brief norms of a residual
+ */
+typedef struct{
+  real_t max_abs; ///< max. norm
+  real_t sum_sq;  ///< squared L2 norm
+} fas_residual_norms;
+
+/**
+ * @brief largest absolute value of an array
+ */
+inline real_t fas_reduce_max_abs(const real_t * x, idx_t n)
+{
+  real_t max_abs = 0.0;
+  #pragma omp parallel for reduction(max:max_abs)
+  for(idx_t l = 0; l < n; l++)
+    max_abs = std::max(max_abs, std::fabs(x[l]));
+  return max_abs;
+}
+
+/**
+ * @brief sum of an array
+ */
+inline real_t fas_reduce_sum(const real_t * x, idx_t n)
+{
+  real_t sum = 0.0;
+  #pragma omp parallel for reduction(+:sum)
+  for(idx_t l = 0; l < n; l++)
+    sum += x[l];
+  return sum;
+}
+
+/**
+ * @brief sum of squares of an array
+ */
+inline real_t fas_reduce_sum_sq(const real_t * x, idx_t n)
+{
+  real_t sum_sq = 0.0;
+  #pragma omp parallel for reduction(+:sum_sq)
+  for(idx_t l = 0; l < n; l++)
+    sum_sq += x[l] * x[l];
+  return sum_sq;
+}
+
+/**
+ * @brief min., max., sum, sum of squares, max. abs. and average of an
+ *  array in a single pass
+ */
+inline fas_grid_stats fas_reduce_stats(const real_t * x, idx_t n)
+{
+  real_t min_val = x[0], max_val = x[0], sum = 0.0, sum_sq = 0.0;
+  #pragma omp parallel for reduction(min:min_val) reduction(max:max_val) \
+    reduction(+:sum,sum_sq)
+  for(idx_t l = 0; l < n; l++)
+  {
+    min_val = std::min(min_val, x[l]);
+    max_val = std::max(max_val, x[l]);
+    sum += x[l];
+    sum_sq += x[l] * x[l];
+  }
+
+  fas_grid_stats stats;
+  stats.min = min_val;
+  stats.max = max_val;
+  stats.sum = sum;
+  stats.sum_sq = sum_sq;
+  stats.max_abs = std::max(std::fabs(min_val), std::fabs(max_val));
+  stats.avg = sum / n;
+  return stats;
+}
+
+/**
+ * @brief max. and squared L2 norm of a residual evaluated point by
+ *  point, tile by tile
+ * @details res(i, j, k, idx) returns the residual at (i, j, k), idx
+ *  being the index of the point in an (unpadded) grid; it may also
+ *  store the residual, e.g. as right hand side of a Jacobian equation
+ *
+ * @param tiling tiles of the grid
+ * @param res residual at a point
+ * @return norms
+ */
+template<class F>
+inline fas_residual_norms fas_reduce_residual(const fas_tiling & tiling, F res)
+{
+  idx_t i, j, k;
+  real_t max_abs = 0.0, sum_sq = 0.0;
+
+  #pragma omp parallel for default(shared) private(i,j,k) \
+    reduction(max:max_abs) reduction(+:sum_sq)
+  FAS_TILED_LOOP3(i, j, k, tiling)
+  {
+    real_t r = res(i, j, k, (i*tiling.ny + j)*tiling.nz + k);
+    max_abs = std::max(max_abs, std::fabs(r));
+    sum_sq += r * r;
+  }
+
+  fas_residual_norms norms;
+  norms.max_abs = max_abs;
+  norms.sum_sq = sum_sq;
+  return norms;
+}
+
+/**
+ * @brief max. and squared L2 norm of the residuals of n_eqns equations,
+ *  evaluated point by point, the equations concurrently
+ * @details res(eqn, i, j, k, idx) returns the residual of equation eqn
+ *  at (i, j, k), as for fas_reduce_residual(); (equation, tile) pairs
+ *  are handed to threads (see FAS_EQN_TILED_LOOP3)
+ *
+ * @param n_eqns number of equations
+ * @param tiling tiles of the grid
+ * @param res residual of an equation at a point
+ * @return norms of all residuals
+ */
+template<class F>
+inline fas_residual_norms fas_reduce_residuals(idx_t n_eqns, const fas_tiling & tiling,
+  F res)
+{
+  idx_t eqn, i, j, k;
+  real_t max_abs = 0.0, sum_sq = 0.0;
+
+  #pragma omp parallel for default(shared) private(eqn,i,j,k) \
+    reduction(max:max_abs) reduction(+:sum_sq)
+  FAS_EQN_TILED_LOOP3(eqn, i, j, k, n_eqns, tiling)
+  {
+    real_t r = res(eqn, i, j, k, (i*tiling.ny + j)*tiling.nz + k);
+    max_abs = std::max(max_abs, std::fabs(r));
+    sum_sq += r * r;
+  }
+
+  fas_residual_norms norms;
+  norms.max_abs = max_abs;
+  norms.sum_sq = sum_sq;
+  return norms;
+}
+
+/**
+ * @brief per-thread partial sums of a short array
+ * @details for sums over arrays, which OpenMP before 4.5 cannot reduce:
+ *  within a parallel region each thread adds to local(), a row of its
+ *  own padded to a cache line, and total() adds the rows in thread
+ *  order afterwards
+ */
+class FASPartialSums
+{
+ public:
+  FASPartialSums(idx_t n_in)
+  {
+    n = n_in;
+    stride = ((n_in + 7) / 8) * 8;
+    rows.assign((std::size_t) omp_get_max_threads() * stride, 0.0);
+  }
+
+  /**
+   * @brief row of calling thread
+   */
+  inline real_t * local()
+  {
+    return &rows[(std::size_t) omp_get_thread_num() * stride];
+  }
+
+  /**
+   * @brief store sums of all rows in result
+   */
+  void total(real_t * result) const
+  {
+    idx_t n_rows = rows.size() / stride;
+    for(idx_t c = 0; c < n; c++)
+    {
+      result[c] = 0.0;
+      for(idx_t t = 0; t < n_rows; t++)
+        result[c] += rows[t * stride + c];
+    }
+  }
+
+ private:
+  idx_t n, stride;
+  std::vector<real_t> rows;
+};
+
+} // namespace cosmo
+
+#endif
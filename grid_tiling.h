@@ -0,0 +1,182 @@
+#ifndef FAS_GRID_TILING_H
+#define FAS_GRID_TILING_H
+
+#include <algorithm>
+#include <cstddef>
+
+#include "../../cosmo_types.h"
+
+/**
+ * loop over all points of a grid tile by tile; the tile loop is the
+ * outermost one, so "#pragma omp parallel for" in front of the macro
+ * hands whole tiles to threads (i, j and k must be private)
+ */
+#define FAS_TILED_LOOP3(i, j, k, tiling)                                 \
+  for(idx_t fas_tile = 0; fas_tile < (tiling).n_tiles; ++fas_tile)       \
+    FAS_TILE_LOOP3(i, j, k, tiling, fas_tile)
+
+/**
+ * loop over all points of a grid for each of n_eqns equations, the
+ * (equation, tile) pairs forming a single iteration space, so that
+ * "#pragma omp parallel for" in front of the macro runs the equations
+ * concurrently as well as the tiles of each (eqn, i, j and k must be
+ * private); coarse grids with few tiles still keep all threads busy
+ */
+#define FAS_EQN_TILED_LOOP3(eqn, i, j, k, n_eqns, tiling)                \
+  for(idx_t fas_task = 0; fas_task < (n_eqns) * (tiling).n_tiles; ++fas_task) \
+    for(eqn = fas_task / (tiling).n_tiles;                               \
+        eqn == fas_task / (tiling).n_tiles; ++eqn)                       \
+      FAS_TILE_LOOP3(i, j, k, tiling, fas_task % (tiling).n_tiles)
+
+/**
+ * loop over the points of a single tile
+ */
+#define FAS_TILE_LOOP3(i, j, k, tiling, tile)                            \
+  for(i = FAS_TILE_BEGIN(tiling, tile, x);                               \
+      i < FAS_TILE_END(tiling, tile, x); ++i)                            \
+    for(j = FAS_TILE_BEGIN(tiling, tile, y);                             \
+        j < FAS_TILE_END(tiling, tile, y); ++j)                          \
+      for(k = FAS_TILE_BEGIN(tiling, tile, z);                           \
+          k < FAS_TILE_END(tiling, tile, z); ++k)
+
+// position of a tile along each axis; tiles are numbered x-major
+#define FAS_TILE_POS_x(tiling, t) ((t) / ((tiling).nty * (tiling).ntz))
+#define FAS_TILE_POS_y(tiling, t) (((t) / (tiling).ntz) % (tiling).nty)
+#define FAS_TILE_POS_z(tiling, t) ((t) % (tiling).ntz)
+
+#define FAS_TILE_BEGIN(tiling, tile, d) \
+  (FAS_TILE_POS_##d(tiling, tile) * (tiling).t##d)
+#define FAS_TILE_END(tiling, tile, d) \
+  std::min((FAS_TILE_POS_##d(tiling, tile) + 1) * (tiling).t##d, (tiling).n##d)
+
+namespace cosmo
+{
+
+/**
+ * @brief decomposition of a grid into tiles
+ */
+typedef struct{
+  idx_t nx, ny, nz;    ///< number of grid points in each direction
+  idx_t tx, ty, tz;    ///< tile size in each direction
+  idx_t ntx, nty, ntz; ///< number of tiles in each direction
+  idx_t n_tiles;       ///< total number of tiles
+} fas_tiling;
+
+/**
+ * @brief bytes of the 2R+1 (padded) i-planes of a tile a stencil sweep
+ *  keeps in cache
+ */
+inline std::size_t fas_tile_window_bytes(idx_t ty, idx_t tz, idx_t radius,
+  idx_t n_grids)
+{
+  return (std::size_t) (2*radius + 1) * (ty + 2*radius) * (tz + 2*radius)
+    * n_grids * sizeof(real_t);
+}
+
+/**
+ * @brief choose tile sizes for sweeps over a grid
+ * @details A sweep over a tile walks i-planes of ty * tz points, keeping
+ *  the 2R+1 planes a stencil of radius R touches in cache. Rows in z are
+ *  kept whole while possible (unit stride), y is split until that window
+ *  fits into cache_bytes, then x is split until every thread has several
+ *  tiles, so that coarse grids with nx < number of threads still
+ *  parallelize.
+ *
+ * @param nx number of points in x direction
+ * @param ny number of points in y direction
+ * @param nz number of points in z direction
+ * @param radius stencil radius
+ * @param n_grids number of grids a sweep streams through
+ * @param cache_bytes cache available to one thread
+ * @param n_threads number of threads sharing the tiles
+ * @return tiling
+ */
+inline fas_tiling fas_plan_tiling(idx_t nx, idx_t ny, idx_t nz, idx_t radius,
+  idx_t n_grids, std::size_t cache_bytes, idx_t n_threads)
+{
+  fas_tiling tiling;
+  tiling.nx = nx;
+  tiling.ny = ny;
+  tiling.nz = nz;
+  tiling.tx = nx;
+  tiling.ty = ny;
+  tiling.tz = nz;
+
+  while(tiling.ty > 8
+      && fas_tile_window_bytes(tiling.ty, tiling.tz, radius, n_grids) > cache_bytes)
+    tiling.ty = (tiling.ty + 1) / 2;
+  while(tiling.tz > 32
+      && fas_tile_window_bytes(tiling.ty, tiling.tz, radius, n_grids) > cache_bytes)
+    tiling.tz = (tiling.tz + 1) / 2;
+
+  tiling.nty = (ny + tiling.ty - 1) / tiling.ty;
+  tiling.ntz = (nz + tiling.tz - 1) / tiling.tz;
+
+  // a few tiles per thread for load balance
+  while(tiling.tx > 1
+      && ((nx + tiling.tx - 1) / tiling.tx) * tiling.nty * tiling.ntz < 4 * n_threads)
+    tiling.tx = (tiling.tx + 1) / 2;
+
+  tiling.ntx = (nx + tiling.tx - 1) / tiling.tx;
+  tiling.n_tiles = tiling.ntx * tiling.nty * tiling.ntz;
+
+  return tiling;
+}
+
+/**
+ * @brief choose tiles for temporally blocked sweeps
+ * @details Several sweeps are applied to a tile extended by halo points
+ *  on every side while it stays in cache, so the whole extended tile
+ *  has to fit into cache_bytes: the longest of x and y (then z) is
+ *  halved until it does, then x is split until every thread has a few
+ *  tiles.
+ *
+ * @param nx number of points in x direction
+ * @param ny number of points in y direction
+ * @param nz number of points in z direction
+ * @param halo width of halo around a tile
+ * @param n_grids number of grids a sweep reads or writes
+ * @param cache_bytes cache available to one thread
+ * @param n_threads number of threads sharing the tiles
+ * @return tiling
+ */
+inline fas_tiling fas_plan_block_tiling(idx_t nx, idx_t ny, idx_t nz, idx_t halo,
+  idx_t n_grids, std::size_t cache_bytes, idx_t n_threads)
+{
+  fas_tiling tiling;
+  tiling.nx = nx;
+  tiling.ny = ny;
+  tiling.nz = nz;
+  tiling.tx = nx;
+  tiling.ty = ny;
+  tiling.tz = nz;
+
+  while((std::size_t) (tiling.tx + 2*halo) * (tiling.ty + 2*halo) * (tiling.tz + 2*halo)
+      * n_grids * sizeof(real_t) > cache_bytes)
+  {
+    if(tiling.tx >= tiling.ty && tiling.tx > 4)
+      tiling.tx = (tiling.tx + 1) / 2;
+    else if(tiling.ty > 4)
+      tiling.ty = (tiling.ty + 1) / 2;
+    else if(tiling.tz > 8)
+      tiling.tz = (tiling.tz + 1) / 2;
+    else
+      break;
+  }
+
+  tiling.nty = (ny + tiling.ty - 1) / tiling.ty;
+  tiling.ntz = (nz + tiling.tz - 1) / tiling.tz;
+
+  while(tiling.tx > 1
+      && ((nx + tiling.tx - 1) / tiling.tx) * tiling.nty * tiling.ntz < 4 * n_threads)
+    tiling.tx = (tiling.tx + 1) / 2;
+
+  tiling.ntx = (nx + tiling.tx - 1) / tiling.tx;
+  tiling.n_tiles = tiling.ntx * tiling.nty * tiling.ntz;
+
+  return tiling;
+}
+
+} // namespace cosmo
+
+#endif
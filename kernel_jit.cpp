@@ -0,0 +1,157 @@
+#include "kernel_jit.h"
+
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+namespace cosmo
+{
+
+/**
+ * @brief set up compiler and cache directory
+ * @param cache_dir_in directory to store kernels in; created if missing
+ */
+FASKernelJIT::FASKernelJIT(const std::string & cache_dir_in)
+{
+  handle = NULL;
+  cache_dir = cache_dir_in;
+
+  const char * env_cxx = std::getenv("FAS_JIT_CXX");
+  const char * env_flags = std::getenv("FAS_JIT_FLAGS");
+  compiler = (env_cxx != NULL) ? env_cxx : "c++";
+  // no -march=native by default: the hash only covers the source and
+  // command, so host-specific code could be loaded from a shared cache
+  // on a different CPU
+  flags = (env_flags != NULL) ? env_flags : "-O3 -std=c++11";
+
+  if(mkdir(cache_dir.c_str(), 0755) != 0 && errno != EEXIST)
+    std::cout << "Unable to create kernel cache directory " << cache_dir
+      << ": " << std::strerror(errno) << ".\n";
+}
+
+FASKernelJIT::~FASKernelJIT()
+{
+  if(handle != NULL)
+    dlclose(handle);
+}
+
+/**
+ * @brief 64-bit FNV-1a hash; stable across runs and platforms,
+ *  unlike std::hash
+ */
+unsigned long long FASKernelJIT::_hash(const std::string & str)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  for(std::string::size_type c = 0; c < str.size(); c++)
+  {
+    h ^= (unsigned char) str[c];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/**
+ * @brief quote a path for use as a single shell word
+ */
+std::string FASKernelJIT::_shellQuote(const std::string & str)
+{
+  std::string quoted = "'";
+  for(std::string::size_type c = 0; c < str.size(); c++)
+  {
+    if(str[c] == '\'')
+      quoted += "'\\''";
+    else
+      quoted += str[c];
+  }
+  return quoted + "'";
+}
+
+/**
+ * @brief load library built from source, compiling it first unless an
+ *  up-to-date library is already in the cache
+ *
+ * @param source complete C++ source of the library
+ * @return whether library was loaded
+ */
+bool FASKernelJIT::load(const std::string & source)
+{
+  std::string command_base = compiler + " " + flags + " -shared -fPIC";
+
+  char hash_str[17];
+  std::snprintf(hash_str, sizeof(hash_str), "%016llx",
+    _hash(source + "\n" + command_base));
+
+  std::string base = cache_dir + "/fas_kernels_" + hash_str;
+  std::string lib = base + ".so";
+
+  if(access(lib.c_str(), R_OK) != 0)
+  {
+    // write and compile under process-unique names, then rename, so
+    // that concurrent runs never compile a partially written source or
+    // load a partially written library
+    char pid_str[32];
+    std::snprintf(pid_str, sizeof(pid_str), ".%ld", (long) getpid());
+    std::string tmp_base = base + pid_str;
+    std::string tmp_src = tmp_base + ".cpp", tmp_lib = tmp_base + ".tmp",
+                tmp_log = tmp_base + ".log";
+
+    std::ofstream out(tmp_src.c_str());
+    out << source;
+    out.close();
+    if(!out)
+    {
+      std::cout << "Unable to write kernel source to " << tmp_src << ".\n";
+      std::remove(tmp_src.c_str());
+      return false;
+    }
+
+    std::string command = command_base + " -o " + _shellQuote(tmp_lib)
+      + " " + _shellQuote(tmp_src) + " > " + _shellQuote(tmp_log) + " 2>&1";
+
+    std::cout << "Compiling equation kernels: " << command << "\n" << std::flush;
+    bool compiled = (std::system(command.c_str()) == 0);
+
+    // keep source and log of the last compilation next to the library
+    std::rename(tmp_src.c_str(), (base + ".cpp").c_str());
+    std::rename(tmp_log.c_str(), (base + ".log").c_str());
+
+    if(!compiled || std::rename(tmp_lib.c_str(), lib.c_str()) != 0)
+    {
+      std::cout << "Compiling equation kernels failed, see " << base << ".log\n";
+      std::remove(tmp_lib.c_str());
+      return false;
+    }
+  }
+
+  void * new_handle = dlopen(lib.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if(new_handle == NULL)
+  {
+    std::cout << "Unable to load equation kernels: " << dlerror() << "\n";
+    return false;
+  }
+
+  if(handle != NULL)
+    dlclose(handle);
+  handle = new_handle;
+
+  return true;
+}
+
+/**
+ * @brief look up a function in the loaded library
+ * @return address of symbol, NULL if not found
+ */
+void * FASKernelJIT::symbol(const std::string & name)
+{
+  if(handle == NULL)
+    return NULL;
+  return dlsym(handle, name.c_str());
+}
+
+} // namespace cosmo
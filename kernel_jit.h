@@ -0,0 +1,86 @@
+#ifndef FAS_KERNEL_JIT_H
+#define FAS_KERNEL_JIT_H
+
+#include <string>
+#include <vector>
+
+#include "equation_kernel.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief C++ spelling of arithmetic types, used in generated source
+ */
+template<typename T> struct fas_type_name;
+template<> struct fas_type_name<float> { static const char * str() { return "float"; } };
+template<> struct fas_type_name<double> { static const char * str() { return "double"; } };
+template<> struct fas_type_name<long double> { static const char * str() { return "long double"; } };
+template<> struct fas_type_name<int> { static const char * str() { return "int"; } };
+template<> struct fas_type_name<long> { static const char * str() { return "long"; } };
+template<> struct fas_type_name<long long> { static const char * str() { return "long long"; } };
+
+/**
+ * @brief compiles generated kernel source into a shared library and
+ *  loads it, caching compiled libraries on disk
+ * @details Libraries are stored as <cache_dir>/fas_kernels_<hash>.so,
+ *  where the hash covers the source and the compile command, so a later
+ *  run with the same equations loads the library without compiling.
+ *  The compiler and flags can be overridden with the FAS_JIT_CXX and
+ *  FAS_JIT_FLAGS environment variables; these are passed to the shell
+ *  as given, while paths are quoted.
+ */
+class FASKernelJIT
+{
+  void * handle;           ///< dlopen handle of loaded library
+  std::string cache_dir;   ///< directory holding sources and libraries
+  std::string compiler;    ///< compiler executable
+  std::string flags;       ///< compile flags
+
+  static unsigned long long _hash(const std::string & str);
+  static std::string _shellQuote(const std::string & str);
+
+ public:
+  FASKernelJIT(const std::string & cache_dir_in);
+  ~FASKernelJIT();
+
+  bool load(const std::string & source);
+
+  void * symbol(const std::string & name);
+};
+
+/**
+ * @brief equation kernel backed by functions from a JIT compiled library
+ */
+class FASJITEquationKernel : public FASEquationKernel
+{
+ public:
+  typedef real_t (*residual_fn)(const fas_kernel_ctx *, idx_t, idx_t, idx_t);
+  typedef void (*jac_fn)(const fas_kernel_ctx *, idx_t, idx_t, idx_t, real_t *, real_t *);
+  typedef real_t (*der_fn)(const fas_kernel_ctx *, idx_t, idx_t, idx_t);
+
+  residual_fn residual_f;       ///< F(u)
+  std::vector<jac_fn> jac_f;    ///< Jacobi coefficients, one per variable
+  std::vector<der_fn> der_f;    ///< directional derivative, one per variable
+
+  real_t residual(const fas_kernel_ctx & ctx, idx_t i, idx_t j, idx_t k)
+  {
+    return residual_f(&ctx, i, j, k);
+  }
+
+  void iterationForJac(const fas_kernel_ctx & ctx, idx_t i, idx_t j, idx_t k,
+    idx_t u_id, real_t & coef_a, real_t & coef_b)
+  {
+    jac_f[u_id](&ctx, i, j, k, &coef_a, &coef_b);
+  }
+
+  real_t derivative(const fas_kernel_ctx & ctx, idx_t i, idx_t j, idx_t k,
+    idx_t u_id)
+  {
+    return der_f[u_id](&ctx, i, j, k);
+  }
+};
+
+} // namespace cosmo
+
+#endif
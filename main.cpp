@@ -2,47 +2,68 @@
 #include <iostream>
 #include <cstdlib>
 
-typedef double real_t;
-typedef long int idx_t;
+using namespace cosmo;
+
 typedef FASMultigrid multigrid_t;
 
 int main(int argc, char **argv)
 {
-  srand(129);
   std::cout.precision(15);
 
   std::cout << "Creating multigrid class...\n";
 
   idx_t max_relax_iters = 5;
-  idx_t relaxation_tolerance = 1e-7;
-
-  multigrid_t::relax_t relax_scheme
-    = multigrid_t::relax_t::inexact_newton_constrained;
+  real_t relaxation_tolerance = 1e-7;
 
-  idx_t grid_length_x = 1, grid_length_y = 1, grid_length_z = 1;
+  // box lengths in different directions
+  real_t box_len[3] = {1.0, 1.0, 1.0};
 
-  // set grid number in different directions;
-  // usually we require: grid_num_i % (2^max_depth) == 0
+  // grid number in different directions is NX, NY and NZ;
+  // usually we require: NX % (2^max_depth) == 0
   // to maintain a fast convergent rate.
   // The code can still deal with arbitrary grid number at any direction.
-  idx_t grid_num_x = 64, grid_num_y = 64, grid_num_z = 64;
   idx_t max_depth = 5; // number of layers for multigrid interation
 
+  // solve lap u - u^3 + rho = 0, one variable with three molecules
+  arr_t u[1];
+  u[0].init(NX, NY, NZ);
+  idx_t molecule_n[1] = {3};
+
   multigrid_t multigrid (
-    grid_num_x, grid_num_y, grid_num_z,
-    grid_length_x, grid_length_y, grid_length_z,
-    max_depth, max_relax_iters, relax_scheme,
-    relaxation_tolerance);
+    u, 1, molecule_n,
+    max_depth, max_relax_iters,
+    relaxation_tolerance, box_len);
+
+  multigrid.relax_scheme = multigrid_t::inexact_newton_constrained;
 
   std::cout << "  initializing...\n";
-  multigrid.setTrialSolution(0);
-  multigrid.add_poly_srcs(0);
+  multigrid.eqns[0][0].init(1, 1.0);
+  multigrid.eqns[0][1].init(1, -1.0);
+  multigrid.eqns[0][2].init(0, 1.0);
+
+  atom atom_tmp;
+  atom_tmp.type = multigrid_t::lap;
+  atom_tmp.u_id = 0;
+  atom_tmp.value = 0;
+  multigrid.add_atom_to_eqn(atom_tmp, 0, 0);
+
+  atom_tmp.type = multigrid_t::poly;
+  atom_tmp.value = 3;
+  multigrid.add_atom_to_eqn(atom_tmp, 1, 0);
+
+  for(idx_t i = 0; i < NX; i++)
+    for(idx_t j = 0; j < NY; j++)
+      for(idx_t k = 0; k < NZ; k++)
+        multigrid.setPolySrcAtPt(0, 2, i, j, k,
+          10.0*sin(2.0*PI*i/NX)*cos(2.0*PI*j/NY) + 3.0*cos(4.0*PI*k/NZ));
+
+  multigrid.initializeRhoHeirarchy();
   std::cout << "  done.\n";
 
   std::cout << "Performing V-Cycles...\n";
   multigrid.VCycles(3);
   std::cout << "  done.\n";
-  
+
   multigrid.printSolutionStrip(max_depth);
 
   return EXIT_SUCCESS;
@@ -0,0 +1,298 @@
+#include "full_multigrid.h"
+#include "equation_dsl.h"
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+
+/**
+ * Manufactured solution regression tests.
+ *
+ * Sources are chosen so that given smooth periodic functions solve the
+ * continuum equations; each solver configuration must then converge, and
+ * the discrete solution must agree with the manufactured one to within
+ * the second order discretization error.
+ */
+
+using namespace cosmo;
+
+typedef FASMultigrid multigrid_t;
+
+// residual solve() has to reach
+#define REGRESSION_TOLERANCE 1e-8
+// cycles solve() may use
+#define REGRESSION_MAX_CYCLES 40
+// bound on max. |u - u_exact| / (h^2 max. |u_exact|)
+#define REGRESSION_ERROR_COEF 10.0
+
+/**
+ * @brief solver configuration exercised by a test
+ */
+typedef struct{
+  const char * name;                         ///< printed with results
+  multigrid_t::relax_t relax_scheme;         ///< relaxation scheme
+  multigrid_t::cycle_t cycle;                ///< cycle type
+  bool set_transfer;                         ///< whether to override the default transfer operators
+  multigrid_t::restriction_t restriction;    ///< restriction, if set_transfer
+  multigrid_t::prolongation_t prolongation;  ///< prolongation, if set_transfer
+  bool jit;                                  ///< whether to JIT compile kernels
+  bool dsl;                                  ///< whether to use DSL kernels
+} regression_case;
+
+static const regression_case regression_cases[] = {
+  {"inexact newton", multigrid_t::inexact_newton, multigrid_t::v_cycle,
+    false, multigrid_t::restrict_full_weighting, multigrid_t::prolong_trilinear, false, false},
+  {"inexact newton, constrained", multigrid_t::inexact_newton_constrained, multigrid_t::v_cycle,
+    false, multigrid_t::restrict_full_weighting, multigrid_t::prolong_trilinear, false, false},
+  {"newton-krylov", multigrid_t::newton, multigrid_t::v_cycle,
+    false, multigrid_t::restrict_full_weighting, multigrid_t::prolong_trilinear, false, false},
+  {"nonlinear gauss-seidel", multigrid_t::nonlinear_gauss_seidel, multigrid_t::v_cycle,
+    false, multigrid_t::restrict_full_weighting, multigrid_t::prolong_trilinear, false, false},
+  {"line relaxation", multigrid_t::line_relaxation, multigrid_t::v_cycle,
+    false, multigrid_t::restrict_full_weighting, multigrid_t::prolong_trilinear, false, false},
+  {"w-cycle", multigrid_t::inexact_newton, multigrid_t::w_cycle,
+    false, multigrid_t::restrict_full_weighting, multigrid_t::prolong_trilinear, false, false},
+  {"f-cycle", multigrid_t::inexact_newton, multigrid_t::f_cycle,
+    false, multigrid_t::restrict_full_weighting, multigrid_t::prolong_trilinear, false, false},
+  {"injection / trilinear", multigrid_t::inexact_newton, multigrid_t::v_cycle,
+    true, multigrid_t::restrict_injection, multigrid_t::prolong_trilinear, false, false},
+  {"half weighting / trilinear", multigrid_t::inexact_newton, multigrid_t::v_cycle,
+    true, multigrid_t::restrict_half_weighting, multigrid_t::prolong_trilinear, false, false},
+  {"full weighting / trilinear", multigrid_t::inexact_newton, multigrid_t::v_cycle,
+    true, multigrid_t::restrict_full_weighting, multigrid_t::prolong_trilinear, false, false},
+  {"injection / tricubic", multigrid_t::inexact_newton, multigrid_t::v_cycle,
+    true, multigrid_t::restrict_injection, multigrid_t::prolong_tricubic, false, false},
+  {"half weighting / tricubic", multigrid_t::inexact_newton, multigrid_t::v_cycle,
+    true, multigrid_t::restrict_half_weighting, multigrid_t::prolong_tricubic, false, false},
+  {"full weighting / tricubic", multigrid_t::inexact_newton, multigrid_t::v_cycle,
+    true, multigrid_t::restrict_full_weighting, multigrid_t::prolong_tricubic, false, false},
+  {"jit kernels", multigrid_t::inexact_newton, multigrid_t::v_cycle,
+    false, multigrid_t::restrict_full_weighting, multigrid_t::prolong_trilinear, true, false},
+  {"dsl kernels", multigrid_t::inexact_newton, multigrid_t::v_cycle,
+    false, multigrid_t::restrict_full_weighting, multigrid_t::prolong_trilinear, false, true}
+};
+
+static const idx_t max_depth = 5;
+
+/**
+ * @brief add a molecule made of a single atom to an equation
+ */
+static void fas_add_single_atom(multigrid_t & multigrid, idx_t eqn_id,
+  idx_t mol_id, real_t coef, idx_t type, idx_t u_id, real_t value)
+{
+  atom atom_tmp;
+  atom_tmp.type = type;
+  atom_tmp.u_id = u_id;
+  atom_tmp.value = value;
+
+  multigrid.eqns[eqn_id][mol_id].init(1, coef);
+  multigrid.add_atom_to_eqn(atom_tmp, mol_id, eqn_id);
+}
+
+/**
+ * @brief apply a test configuration and solve, keeping the solver log
+ *
+ * @return whether solve() converged
+ */
+static bool fas_configure_and_solve(multigrid_t & multigrid,
+  const regression_case & test, FASEquationKernel * dsl_kernels[],
+  std::ostringstream & log)
+{
+  if(test.set_transfer)
+    for(idx_t depth = 2; depth <= max_depth; depth++)
+      multigrid.setTransferOperators(depth, test.restriction, test.prolongation);
+
+  multigrid.initializeRhoHeirarchy();
+
+  if(test.relax_scheme == multigrid_t::line_relaxation)
+    multigrid.setLineRelaxation(0);
+  else
+    multigrid.relax_scheme = test.relax_scheme;
+  multigrid.setCycle(test.cycle, 2, 2);
+
+  if(test.dsl)
+    for(idx_t eqn_id = 0; dsl_kernels[eqn_id] != NULL; eqn_id++)
+      multigrid.setEquationKernel(eqn_id, dsl_kernels[eqn_id]);
+  if(test.jit && !multigrid.enableKernelJIT())
+  {
+    log << "JIT kernels unavailable.\n";
+    return false;
+  }
+
+  solve_result result = multigrid.solve(REGRESSION_TOLERANCE, REGRESSION_MAX_CYCLES);
+  log << "solve() status " << result.status << " after " << result.cycles
+    << " cycles, residual " << result.final_residual << ".\n";
+  log << "Residual reduction factors:";
+  for(std::size_t c = 0; c < result.factors.size(); c++)
+    log << " " << result.factors[c];
+  log << "\n";
+  return result.status == solve_converged;
+}
+
+/**
+ * @brief compare solution with manufactured one and report outcome
+ *
+ * @return whether test passed
+ */
+static bool fas_report(const char * problem, const regression_case & test,
+  bool converged, arr_t u[], arr_t u_exact[], idx_t u_n,
+  const std::string & log)
+{
+  real_t h = 1.0 / std::max(NX, std::max(NY, NZ));
+  real_t err = 0.0, scale = 0.0;
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+    for(idx_t idx = 0; idx < u[u_id].pts; idx++)
+    {
+      err = std::max(err, std::fabs(u[u_id][idx] - u_exact[u_id][idx]));
+      scale = std::max(scale, std::fabs(u_exact[u_id][idx]));
+    }
+  real_t err_coef = err / (h * h * scale);
+
+  bool passed = converged && err_coef <= REGRESSION_ERROR_COEF;
+  std::cout << (passed ? "  passed: " : "  FAILED: ") << problem << ", "
+    << test.name << "; max. error " << err << " (" << err_coef
+    << " h^2 max. |u|).\n";
+  if(!passed)
+    std::cout << log;
+
+  return passed;
+}
+
+/**
+ * @brief lap u - u^3 + rho = 0
+ */
+static bool fas_test_scalar(const regression_case & test)
+{
+  arr_t u[1], u_exact[1];
+  u[0].init(NX, NY, NZ);
+  u_exact[0].init(NX, NY, NZ);
+  idx_t molecule_n[1] = {3};
+
+  std::ostringstream log;
+  std::streambuf * cout_buf = std::cout.rdbuf(log.rdbuf());
+  bool converged = false;
+
+  try
+  {
+    multigrid_t multigrid(u, 1, molecule_n, max_depth, 5, 1e-9);
+
+    fas_add_single_atom(multigrid, 0, 0, 1.0, multigrid_t::lap, 0, 0);
+    fas_add_single_atom(multigrid, 0, 1, -1.0, multigrid_t::poly, 0, 3);
+    multigrid.eqns[0][2].init(0, 1.0);
+
+    const real_t k = 2.0*PI;
+    for(idx_t i = 0; i < NX; i++)
+      for(idx_t j = 0; j < NY; j++)
+        for(idx_t l = 0; l < NZ; l++)
+        {
+          real_t x = (real_t) i / NX, y = (real_t) j / NY, z = (real_t) l / NZ;
+          real_t ue = 0.5*sin(k*x)*cos(k*y) + 0.2*sin(2.0*k*z);
+          real_t lap_ue = -2.0*k*k*0.5*sin(k*x)*cos(k*y) - 4.0*k*k*0.2*sin(2.0*k*z);
+          u_exact[0][H_INDEX(i, j, l, NX, NY, NZ)] = ue;
+          multigrid.setPolySrcAtPt(0, 2, i, j, l, ue*ue*ue - lap_ue);
+        }
+
+    using namespace cosmo::fas_dsl;
+    auto k0 = kernel(Lap<U0>() - Pow<U0,3>() + Rho<2>());
+    FASEquationKernel * dsl_kernels[2] = {&k0, NULL};
+
+    converged = fas_configure_and_solve(multigrid, test, dsl_kernels, log);
+  }
+  catch(...)
+  {
+    log << "Solver threw an exception.\n";
+  }
+
+  std::cout.rdbuf(cout_buf);
+  return fas_report("scalar", test, converged, u, u_exact, 1, log.str());
+}
+
+/**
+ * @brief lap u0 + 0.5 d_x d_y u1 - u0 + rho0 = 0,
+ *  lap u1 - u1 - 0.2 u0^2 + rho1 = 0
+ */
+static bool fas_test_system(const regression_case & test)
+{
+  arr_t u[2], u_exact[2];
+  for(idx_t u_id = 0; u_id < 2; u_id++)
+  {
+    u[u_id].init(NX, NY, NZ);
+    u_exact[u_id].init(NX, NY, NZ);
+  }
+  idx_t molecule_n[2] = {4, 4};
+
+  std::ostringstream log;
+  std::streambuf * cout_buf = std::cout.rdbuf(log.rdbuf());
+  bool converged = false;
+
+  try
+  {
+    multigrid_t multigrid(u, 2, molecule_n, max_depth, 5, 1e-9);
+
+    fas_add_single_atom(multigrid, 0, 0, 1.0, multigrid_t::lap, 0, 0);
+    fas_add_single_atom(multigrid, 0, 1, 0.5, multigrid_t::der12, 1, 0);
+    fas_add_single_atom(multigrid, 0, 2, -1.0, multigrid_t::poly, 0, 1);
+    multigrid.eqns[0][3].init(0, 1.0);
+
+    fas_add_single_atom(multigrid, 1, 0, 1.0, multigrid_t::lap, 1, 0);
+    fas_add_single_atom(multigrid, 1, 1, -1.0, multigrid_t::poly, 1, 1);
+    fas_add_single_atom(multigrid, 1, 2, -0.2, multigrid_t::poly, 0, 2);
+    multigrid.eqns[1][3].init(0, 1.0);
+
+    const real_t k = 2.0*PI;
+    for(idx_t i = 0; i < NX; i++)
+      for(idx_t j = 0; j < NY; j++)
+        for(idx_t l = 0; l < NZ; l++)
+        {
+          real_t x = (real_t) i / NX, y = (real_t) j / NY, z = (real_t) l / NZ;
+          real_t u0 = 0.4*sin(k*x)*cos(k*z);
+          real_t u1 = 0.5*cos(k*x)*cos(k*y) + 0.3*sin(k*z);
+          real_t lap_u0 = -2.0*k*k*u0;
+          real_t lap_u1 = -2.0*k*k*0.5*cos(k*x)*cos(k*y) - k*k*0.3*sin(k*z);
+          real_t dxdy_u1 = k*k*0.5*sin(k*x)*sin(k*y);
+          idx_t idx = H_INDEX(i, j, l, NX, NY, NZ);
+          u_exact[0][idx] = u0;
+          u_exact[1][idx] = u1;
+          multigrid.setPolySrcAtPt(0, 3, i, j, l, u0 - lap_u0 - 0.5*dxdy_u1);
+          multigrid.setPolySrcAtPt(1, 3, i, j, l, u1 - lap_u1 + 0.2*u0*u0);
+        }
+
+    using namespace cosmo::fas_dsl;
+    auto k0 = kernel(Lap<U0>() + 0.5 * Mixed<U1,1,2>() - Val<U0>() + Rho<3>());
+    auto k1 = kernel(Lap<U1>() - Val<U1>() - 0.2 * Pow<U0,2>() + Rho<3>());
+    FASEquationKernel * dsl_kernels[3] = {&k0, &k1, NULL};
+
+    converged = fas_configure_and_solve(multigrid, test, dsl_kernels, log);
+  }
+  catch(...)
+  {
+    log << "Solver threw an exception.\n";
+  }
+
+  std::cout.rdbuf(cout_buf);
+  return fas_report("system", test, converged, u, u_exact, 2, log.str());
+}
+
+int main(int argc, char **argv)
+{
+  std::cout.precision(6);
+
+  idx_t n_cases = sizeof(regression_cases) / sizeof(regression_cases[0]);
+  idx_t failed = 0;
+
+  std::cout << "Running manufactured solution tests on a " << NX << " x "
+    << NY << " x " << NZ << " grid...\n";
+  for(idx_t c = 0; c < n_cases; c++)
+  {
+    failed += !fas_test_scalar(regression_cases[c]);
+    failed += !fas_test_system(regression_cases[c]);
+  }
+
+  if(failed > 0)
+  {
+    std::cout << failed << " of " << 2*n_cases << " tests failed.\n";
+    return EXIT_FAILURE;
+  }
+  std::cout << "All " << 2*n_cases << " tests passed.\n";
+
+  return EXIT_SUCCESS;
+}
@@ -1,7 +1,7 @@
 #!/bin/bash
 
-# Just try to compile and run for now.
-g++ main.cpp full_multigrid.cpp -O3 -Wall --std=c++11 -fopenmp
+# Compile and run the example.
+g++ main.cpp full_multigrid.cpp kernel_jit.cpp -O3 -Wall --std=c++11 -fopenmp -ldl
 if [ $? -ne 0 ]; then
     echo "Error: compile failed."
     exit 1
@@ -12,3 +12,16 @@ if [ $? -ne 0 ]; then
     echo "Error: run failed."
     exit 1
 fi
+
+# Manufactured solution regression tests.
+g++ regression_tests.cpp full_multigrid.cpp kernel_jit.cpp -O3 -Wall --std=c++11 -fopenmp -ldl -o regression_tests
+if [ $? -ne 0 ]; then
+    echo "Error: regression test compile failed."
+    exit 1
+fi
+
+time ./regression_tests
+if [ $? -ne 0 ]; then
+    echo "Error: regression tests failed."
+    exit 1
+fi